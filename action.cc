@@ -9,6 +9,7 @@
 #include "common.h"
 #include "threads-model.h"
 #include "wildcard.h"
+#include "datarace.h"
 
 #define ACTION_INITIAL_CLOCK 0
 
@@ -18,6 +19,19 @@
 /** @brief A special value to represent a failed trylock */
 #define VALUE_TRYFAILED 0
 
+/**
+ * @brief Allocates an action in the snapshotting heap
+ *
+ * The model-checker entry points allocate their action before switching to
+ * the model-checker, while the race helper thread (-A) may still be using
+ * the heap; this is where they wait for it.
+ */
+void * ModelAction::operator new(size_t size)
+{
+	RACEQUIESCE();
+	return snapshot_malloc(size);
+}
+
 /**
  * @brief Construct a new ModelAction
  *
@@ -39,6 +53,7 @@ ModelAction::ModelAction(action_type_t type, memory_order order, void *loc,
 	cv(NULL),
 	rf_cv(NULL),
 	action_ref(NULL),
+	cycle_node(NULL),
 	value(value),
 	type(type),
 	order(order),
@@ -71,6 +86,7 @@ ModelAction::ModelAction(action_type_t type, memory_order order, uint64_t value,
 	cv(NULL),
 	rf_cv(NULL),
 	action_ref(NULL),
+	cycle_node(NULL),
 	value(value),
 	type(type),
 	order(order),
@@ -102,6 +118,7 @@ ModelAction::ModelAction(action_type_t type, memory_order order, void *loc,
 	cv(NULL),
 	rf_cv(NULL),
 	action_ref(NULL),
+	cycle_node(NULL),
 	value(value),
 	type(type),
 	order(order),
@@ -136,6 +153,7 @@ ModelAction::ModelAction(action_type_t type, const char * position, memory_order
 	cv(NULL),
 	rf_cv(NULL),
 	action_ref(NULL),
+	cycle_node(NULL),
 	value(value),
 	type(type),
 	order(order),
@@ -171,6 +189,7 @@ ModelAction::ModelAction(action_type_t type, const char * position, memory_order
 	cv(NULL),
 	rf_cv(NULL),
 	action_ref(NULL),
+	cycle_node(NULL),
 	value(value),
 	type(type),
 	order(order),
@@ -196,7 +196,18 @@ public:
 	void setActionRef(sllnode<ModelAction *> *ref) { action_ref = ref; }
 	sllnode<ModelAction *> * getActionRef() { return action_ref; }
 
-	SNAPSHOTALLOC
+	CycleNode * get_cycle_node() const { return cycle_node; }
+	void set_cycle_node(CycleNode *node) { cycle_node = node; }
+
+	/* Like SNAPSHOTALLOC, but actions are built in user context before
+	   switch_thread(), so operator new first waits out the race helper */
+	void * operator new(size_t size);
+	void operator delete(void *p, size_t size) {
+		snapshot_free(p);
+	}
+	void * operator new(size_t size, void *p) {	/* placement new */
+		return p;
+	}
 private:
 	const char * get_type_str() const;
 	const char * get_mo_str() const;
@@ -232,6 +243,10 @@ private:
 	ClockVector *rf_cv;
 	sllnode<ModelAction *> * action_ref;
 
+	/** @brief The node of this write in the modification order graph, or
+	 *  NULL */
+	CycleNode *cycle_node;
+
 	/** @brief The value written (for write or RMW; undefined for read) */
 	uint64_t value;
 
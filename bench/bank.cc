@@ -0,0 +1,60 @@
+/** @file bank.cc
+ *  @brief Benchmark: mutex-protected transfers between bank accounts.
+ */
+
+#include <pthread.h>
+
+#include "cmodelint.h"
+#include "librace.h"
+#include "model-assert.h"
+
+using namespace std;
+
+#define NUM_ACCOUNTS 3
+#define NUM_THREADS 3
+#define TRANSFERS 3
+#define INITIAL_BALANCE 100
+
+static uint32_t balance[NUM_ACCOUNTS];
+static pthread_mutex_t lock[NUM_ACCOUNTS];
+
+static void transfer(int from, int to, uint32_t amount)
+{
+	/* Lock in a fixed order to stay clear of deadlocks */
+	int first = from < to ? from : to;
+	int second = from < to ? to : from;
+	pthread_mutex_lock(&lock[first]);
+	pthread_mutex_lock(&lock[second]);
+	store_32(&balance[from], load_32(&balance[from]) - amount);
+	store_32(&balance[to], load_32(&balance[to]) + amount);
+	pthread_mutex_unlock(&lock[second]);
+	pthread_mutex_unlock(&lock[first]);
+}
+
+static void * teller(void *arg)
+{
+	uintptr_t id = (uintptr_t)arg;
+	for (int i = 0;i < TRANSFERS;i++)
+		transfer((id + i) % NUM_ACCOUNTS, (id + i + 1) % NUM_ACCOUNTS, 10);
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t threads[NUM_THREADS];
+
+	for (int i = 0;i < NUM_ACCOUNTS;i++) {
+		pthread_mutex_init(&lock[i], NULL);
+		store_32(&balance[i], INITIAL_BALANCE);
+	}
+	for (uintptr_t i = 0;i < NUM_THREADS;i++)
+		pthread_create(&threads[i], NULL, teller, (void *)i);
+	for (int i = 0;i < NUM_THREADS;i++)
+		pthread_join(threads[i], NULL);
+
+	uint32_t total = 0;
+	for (int i = 0;i < NUM_ACCOUNTS;i++)
+		total += load_32(&balance[i]);
+	MODEL_ASSERT(total == NUM_ACCOUNTS * INITIAL_BALANCE);
+	return 0;
+}
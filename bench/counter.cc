@@ -0,0 +1,36 @@
+/** @file counter.cc
+ *  @brief Benchmark: threads bumping a shared relaxed counter.
+ */
+
+#include <pthread.h>
+
+#include "cmodelint.h"
+#include "model-assert.h"
+
+using namespace std;
+
+#define NUM_THREADS 3
+#define INCREMENTS 5
+
+static uint32_t counter;
+
+static void * worker(void *arg)
+{
+	for (int i = 0;i < INCREMENTS;i++)
+		cds_atomic_fetch_add32(&counter, 1, memory_order_relaxed, "counter.cc:fetch_add");
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t threads[NUM_THREADS];
+
+	cds_atomic_init32(&counter, 0, "counter.cc:init");
+	for (int i = 0;i < NUM_THREADS;i++)
+		pthread_create(&threads[i], NULL, worker, NULL);
+	for (int i = 0;i < NUM_THREADS;i++)
+		pthread_join(threads[i], NULL);
+
+	MODEL_ASSERT(cds_atomic_load32(&counter, memory_order_relaxed, "counter.cc:load") == NUM_THREADS * INCREMENTS);
+	return 0;
+}
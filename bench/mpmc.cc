@@ -0,0 +1,105 @@
+/** @file mpmc.cc
+ *  @brief Benchmark: bounded multi-producer multi-consumer queue.
+ *
+ *  Each cell carries a sequence number that tells producers and consumers
+ *  whose turn it is, in the style of Vyukov's bounded queue.
+ */
+
+#include <pthread.h>
+
+#include "cmodelint.h"
+#include "librace.h"
+#include "model-assert.h"
+
+using namespace std;
+
+#define QUEUE_SIZE 2
+#define PRODUCERS 2
+#define CONSUMERS 2
+#define ITEMS 1	/* per producer and per consumer */
+
+struct cell {
+	uint32_t seq;
+	uint32_t value;
+};
+
+static struct cell cells[QUEUE_SIZE];
+static uint32_t enqueue_pos;
+static uint32_t dequeue_pos;
+static uint32_t consumed;	/* sum of the dequeued values */
+
+static void enqueue(uint32_t value)
+{
+	uint32_t pos = cds_atomic_load32(&enqueue_pos, memory_order_relaxed, "mpmc.cc:enqueue_pos");
+	while (true) {
+		struct cell *c = &cells[pos % QUEUE_SIZE];
+		uint32_t seq = cds_atomic_load32(&c->seq, memory_order_acquire, "mpmc.cc:enqueue_seq");
+		if (seq == pos) {
+			uint32_t seen = cds_atomic_compare_exchange32_v1(&enqueue_pos, pos, pos + 1, memory_order_relaxed, memory_order_relaxed, "mpmc.cc:enqueue_cas");
+			if (seen == pos) {
+				store_32(&c->value, value);
+				cds_atomic_store32(&c->seq, pos + 1, memory_order_release, "mpmc.cc:enqueue_publish");
+				return;
+			}
+			pos = seen;
+		} else {
+			/* Full, or another producer got there first */
+			pos = cds_atomic_load32(&enqueue_pos, memory_order_relaxed, "mpmc.cc:enqueue_retry");
+		}
+	}
+}
+
+static uint32_t dequeue()
+{
+	uint32_t pos = cds_atomic_load32(&dequeue_pos, memory_order_relaxed, "mpmc.cc:dequeue_pos");
+	while (true) {
+		struct cell *c = &cells[pos % QUEUE_SIZE];
+		uint32_t seq = cds_atomic_load32(&c->seq, memory_order_acquire, "mpmc.cc:dequeue_seq");
+		if (seq == pos + 1) {
+			uint32_t seen = cds_atomic_compare_exchange32_v1(&dequeue_pos, pos, pos + 1, memory_order_relaxed, memory_order_relaxed, "mpmc.cc:dequeue_cas");
+			if (seen == pos) {
+				uint32_t value = load_32(&c->value);
+				cds_atomic_store32(&c->seq, pos + QUEUE_SIZE, memory_order_release, "mpmc.cc:dequeue_release");
+				return value;
+			}
+			pos = seen;
+		} else {
+			/* Empty, or another consumer got there first */
+			pos = cds_atomic_load32(&dequeue_pos, memory_order_relaxed, "mpmc.cc:dequeue_retry");
+		}
+	}
+}
+
+static void * producer(void *arg)
+{
+	for (int i = 0;i < ITEMS;i++)
+		enqueue((uintptr_t)arg);
+	return NULL;
+}
+
+static void * consumer(void *arg)
+{
+	for (int i = 0;i < ITEMS;i++)
+		cds_atomic_fetch_add32(&consumed, dequeue(), memory_order_relaxed, "mpmc.cc:sum");
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t threads[PRODUCERS + CONSUMERS];
+
+	for (uint32_t i = 0;i < QUEUE_SIZE;i++)
+		cds_atomic_init32(&cells[i].seq, i, "mpmc.cc:init_seq");
+	cds_atomic_init32(&enqueue_pos, 0, "mpmc.cc:init_enqueue");
+	cds_atomic_init32(&dequeue_pos, 0, "mpmc.cc:init_dequeue");
+	cds_atomic_init32(&consumed, 0, "mpmc.cc:init_consumed");
+	for (uintptr_t i = 0;i < PRODUCERS;i++)
+		pthread_create(&threads[i], NULL, producer, (void *)(i + 1));
+	for (int i = 0;i < CONSUMERS;i++)
+		pthread_create(&threads[PRODUCERS + i], NULL, consumer, NULL);
+	for (int i = 0;i < PRODUCERS + CONSUMERS;i++)
+		pthread_join(threads[i], NULL);
+
+	MODEL_ASSERT(cds_atomic_load32(&consumed, memory_order_relaxed, "mpmc.cc:total") == ITEMS * PRODUCERS * (PRODUCERS + 1) / 2);
+	return 0;
+}
@@ -0,0 +1,49 @@
+/** @file relay.cc
+ *  @brief Benchmark: many threads passing release/acquire flags around a
+ *  ring.
+ *
+ *  Each acquire joins the clock of a neighbour that knows little more than
+ *  the reader, so the run is dominated by clock vector joins across many
+ *  threads.
+ */
+
+#include <pthread.h>
+
+#include "cmodelint.h"
+#include "model-assert.h"
+
+using namespace std;
+
+#define NUM_THREADS 32
+#define ROUNDS 3
+
+static uint32_t flags[NUM_THREADS];
+
+static void * worker(void *arg)
+{
+	uint32_t id = (uint32_t)(uintptr_t)arg;
+	uint32_t *next = &flags[(id + 1) % NUM_THREADS];
+
+	for (uint32_t i = 1;i <= ROUNDS;i++) {
+		uint32_t seen = cds_atomic_load32(next, memory_order_acquire, "relay.cc:acquire");
+		MODEL_ASSERT(seen <= ROUNDS);
+		cds_atomic_store32(&flags[id], i, memory_order_release, "relay.cc:release");
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t threads[NUM_THREADS];
+
+	for (int i = 0;i < NUM_THREADS;i++)
+		cds_atomic_init32(&flags[i], 0, "relay.cc:init");
+	for (int i = 0;i < NUM_THREADS;i++)
+		pthread_create(&threads[i], NULL, worker, (void *)(uintptr_t)i);
+	for (int i = 0;i < NUM_THREADS;i++)
+		pthread_join(threads[i], NULL);
+
+	for (int i = 0;i < NUM_THREADS;i++)
+		MODEL_ASSERT(cds_atomic_load32(&flags[i], memory_order_acquire, "relay.cc:check") == ROUNDS);
+	return 0;
+}
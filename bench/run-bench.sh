@@ -0,0 +1,46 @@
+#!/bin/sh
+#
+# Runs each benchmark under the model-checker and prints the results as JSON
+# Syntax:
+#  ./run-bench.sh BENCHMARK...
+#
+# BENCH_EXECUTIONS sets the number of executions per benchmark (default:
+# 1000); BENCH_OPTIONS adds C11TESTER options to every run.
+#
+
+BINDIR="${0%/*}"
+EXECUTIONS=${BENCH_EXECUTIONS:-1000}
+
+export LD_LIBRARY_PATH=${BINDIR}/..
+# For Mac OSX
+export DYLD_LIBRARY_PATH=${BINDIR}/..
+
+# Print the number in the first line of $OUT that starts with $1
+stat() {
+	echo "$OUT" | sed -n "s/^$1[^0-9]*\([0-9][0-9]*\).*/\1/p" | head -n 1
+}
+
+# Print $1 / $2 with one decimal
+rate() {
+	echo "$1 $2" | awk '{ printf "%.1f", ($2 > 0) ? $1 / $2 : 0 }'
+}
+
+printf "["
+SEP=""
+for BENCH in "$@"; do
+	START=$(date +%s%N)
+	OUT=$(C11TESTER="-x $EXECUTIONS $BENCH_OPTIONS" "$BINDIR/$BENCH" 2>&1)
+	END=$(date +%s%N)
+	ELAPSED=$(echo "$START $END" | awk '{ printf "%.3f", ($2 - $1) / 1e9 }')
+	EXECS=$(stat "Total executions")
+	ACTIONS=$(stat "Total actions")
+	RSS=$(stat "Peak RSS")
+	BUGGY=$(stat "Number of buggy executions")
+	RACES=$(echo "$OUT" | grep -c "^Data race detected")
+	printf '%s\n  {"benchmark": "%s", "seconds": %s, "executions": %s, "executions_per_sec": %s, "actions": %s, "actions_per_sec": %s, "peak_rss_kb": %s, "buggy_executions": %s, "races": %s}' \
+		"$SEP" "$BENCH" "$ELAPSED" "${EXECS:-0}" "$(rate "${EXECS:-0}" "$ELAPSED")" \
+		"${ACTIONS:-0}" "$(rate "${ACTIONS:-0}" "$ELAPSED")" "${RSS:-0}" "${BUGGY:-0}" "$RACES"
+	SEP=","
+done
+echo
+echo "]"
@@ -0,0 +1,60 @@
+/** @file seqlock.cc
+ *  @brief Benchmark: a sequence lock with one writer and two readers.
+ *
+ *  The protected data is read with plain loads, as many real seqlocks do.
+ *  Those reads race with the writer, so the race detector is expected to
+ *  report them.
+ */
+
+#include <pthread.h>
+
+#include "cmodelint.h"
+#include "librace.h"
+#include "model-assert.h"
+
+using namespace std;
+
+#define WRITES 2
+
+static uint32_t seq;
+static uint32_t data1, data2;
+
+static void * writer(void *arg)
+{
+	for (uint32_t i = 1;i <= WRITES;i++) {
+		uint32_t s = cds_atomic_load32(&seq, memory_order_relaxed, "seqlock.cc:writer_seq");
+		cds_atomic_store32(&seq, s + 1, memory_order_relaxed, "seqlock.cc:begin");
+		cds_atomic_thread_fence(memory_order_release, "seqlock.cc:writer_fence");
+		store_32(&data1, i);
+		store_32(&data2, i);
+		cds_atomic_store32(&seq, s + 2, memory_order_release, "seqlock.cc:end");
+	}
+	return NULL;
+}
+
+static void * reader(void *arg)
+{
+	uint32_t s1, s2, d1, d2;
+	do {
+		s1 = cds_atomic_load32(&seq, memory_order_acquire, "seqlock.cc:read_begin");
+		d1 = load_32(&data1);
+		d2 = load_32(&data2);
+		cds_atomic_thread_fence(memory_order_acquire, "seqlock.cc:reader_fence");
+		s2 = cds_atomic_load32(&seq, memory_order_relaxed, "seqlock.cc:read_end");
+	} while ((s1 & 1) || s1 != s2);
+	MODEL_ASSERT(d1 == d2);
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t threads[3];
+
+	cds_atomic_init32(&seq, 0, "seqlock.cc:init");
+	pthread_create(&threads[0], NULL, writer, NULL);
+	pthread_create(&threads[1], NULL, reader, NULL);
+	pthread_create(&threads[2], NULL, reader, NULL);
+	for (int i = 0;i < 3;i++)
+		pthread_join(threads[i], NULL);
+	return 0;
+}
@@ -0,0 +1,58 @@
+/** @file spsc.cc
+ *  @brief Benchmark: single-producer single-consumer ring buffer.
+ *
+ *  The slots are plain memory; the head and tail indices hand them over with
+ *  release/acquire.
+ */
+
+#include <pthread.h>
+
+#include "cmodelint.h"
+#include "librace.h"
+#include "model-assert.h"
+
+using namespace std;
+
+#define RING_SIZE 4
+#define ITEMS 6
+
+static uint32_t slots[RING_SIZE];
+static uint32_t head;	/* next slot to read; written by the consumer */
+static uint32_t tail;	/* next slot to write; written by the producer */
+
+static void * producer(void *arg)
+{
+	for (uint32_t i = 1;i <= ITEMS;i++) {
+		uint32_t t = cds_atomic_load32(&tail, memory_order_relaxed, "spsc.cc:producer_tail");
+		while (t - cds_atomic_load32(&head, memory_order_acquire, "spsc.cc:producer_head") == RING_SIZE)
+			;
+		store_32(&slots[t % RING_SIZE], i);
+		cds_atomic_store32(&tail, t + 1, memory_order_release, "spsc.cc:publish");
+	}
+	return NULL;
+}
+
+static void * consumer(void *arg)
+{
+	for (uint32_t i = 1;i <= ITEMS;i++) {
+		uint32_t h = cds_atomic_load32(&head, memory_order_relaxed, "spsc.cc:consumer_head");
+		while (cds_atomic_load32(&tail, memory_order_acquire, "spsc.cc:consumer_tail") == h)
+			;
+		MODEL_ASSERT(load_32(&slots[h % RING_SIZE]) == i);
+		cds_atomic_store32(&head, h + 1, memory_order_release, "spsc.cc:release");
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t prod, cons;
+
+	cds_atomic_init32(&head, 0, "spsc.cc:init_head");
+	cds_atomic_init32(&tail, 0, "spsc.cc:init_tail");
+	pthread_create(&prod, NULL, producer, NULL);
+	pthread_create(&cons, NULL, consumer, NULL);
+	pthread_join(prod, NULL);
+	pthread_join(cons, NULL);
+	return 0;
+}
@@ -0,0 +1,85 @@
+/** @file treiber.cc
+ *  @brief Benchmark: Treiber stack with concurrent pushes and pops.
+ *
+ *  Nodes are never reused, so the stack is free of ABA problems.
+ */
+
+#include <pthread.h>
+
+#include "cmodelint.h"
+#include "librace.h"
+#include "model-assert.h"
+
+using namespace std;
+
+#define NUM_THREADS 3
+#define OPS 2
+
+struct node {
+	uint32_t value;
+	struct node *next;
+};
+
+static struct node nodes[NUM_THREADS * OPS];
+static uint64_t top;	/* struct node * */
+static uint32_t popped;	/* sum of the popped values */
+
+static void push(struct node *n)
+{
+	uint64_t old = cds_atomic_load64(&top, memory_order_relaxed, "treiber.cc:push_load");
+	while (true) {
+		store_64(&n->next, old);
+		uint64_t seen = cds_atomic_compare_exchange64_v1(&top, old, (uint64_t)n, memory_order_release, memory_order_relaxed, "treiber.cc:push_cas");
+		if (seen == old)
+			return;
+		old = seen;
+	}
+}
+
+static struct node * pop()
+{
+	uint64_t old = cds_atomic_load64(&top, memory_order_acquire, "treiber.cc:pop_load");
+	while (old != 0) {
+		uint64_t next = load_64(&((struct node *)old)->next);
+		uint64_t seen = cds_atomic_compare_exchange64_v1(&top, old, next, memory_order_acquire, memory_order_acquire, "treiber.cc:pop_cas");
+		if (seen == old)
+			break;
+		old = seen;
+	}
+	return (struct node *)old;
+}
+
+static void * worker(void *arg)
+{
+	uintptr_t id = (uintptr_t)arg;
+	for (int i = 0;i < OPS;i++) {
+		struct node *n = &nodes[id * OPS + i];
+		store_32(&n->value, id * OPS + i + 1);
+		push(n);
+		/* May find the stack empty; main pops whatever is left */
+		n = pop();
+		if (n != NULL)
+			cds_atomic_fetch_add32(&popped, load_32(&n->value), memory_order_relaxed, "treiber.cc:sum");
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t threads[NUM_THREADS];
+
+	cds_atomic_init64(&top, 0, "treiber.cc:init_top");
+	cds_atomic_init32(&popped, 0, "treiber.cc:init_popped");
+	for (uintptr_t i = 0;i < NUM_THREADS;i++)
+		pthread_create(&threads[i], NULL, worker, (void *)i);
+	for (int i = 0;i < NUM_THREADS;i++)
+		pthread_join(threads[i], NULL);
+
+	struct node *left;
+	while ((left = pop()) != NULL)
+		cds_atomic_fetch_add32(&popped, load_32(&left->value), memory_order_relaxed, "treiber.cc:sum_left");
+
+	uint32_t n = NUM_THREADS * OPS;
+	MODEL_ASSERT(cds_atomic_load32(&popped, memory_order_relaxed, "treiber.cc:total") == n * (n + 1) / 2);
+	return 0;
+}
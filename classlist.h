@@ -8,6 +8,7 @@
 class ClockVector;
 class CycleGraph;
 class CycleNode;
+class CyclePartition;
 class ModelAction;
 class ModelChecker;
 class ModelExecution;
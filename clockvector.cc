@@ -6,8 +6,331 @@
 #include "clockvector.h"
 #include "common.h"
 #include "threads-model.h"
+#include "params.h"
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
 
 
+/** Clocks per vector register of the widest merge kernel.  Clock arrays
+ *  are aligned to and padded out to a multiple of this many clocks, and the
+ *  padding stays zero. */
+#define CLOCKLANES 8
+
+static inline int paddedLength(int num_threads)
+{
+	return (num_threads + CLOCKLANES - 1) & ~(CLOCKLANES - 1);
+}
+
+/** Whether clock vectors are tree clocks (-T) */
+static bool treeClocks;
+
+/**
+ * The header lanes in front of a clock array hold the count of vectors
+ * sharing it, its capacity in clocks, whether it carries a tree and the
+ * first top-level node of that tree.
+ */
+enum { CLOCKREFS, CLOCKCAPACITY, CLOCKTREE, CLOCKTOP };
+
+static inline modelclock_t & clockHeader(const modelclock_t *clock, int lane)
+{
+	return const_cast<modelclock_t *>(clock)[lane - CLOCKLANES];
+}
+
+static inline modelclock_t & clockRefs(modelclock_t *clock)
+{
+	return clockHeader(clock, CLOCKREFS);
+}
+
+/**
+ * A tree clock array keeps, after its clocks, an array per link: for each
+ * thread, the clock its parent had when it was attached, and its parent,
+ * first child and siblings as thread indices plus one (0 for none).
+ * Top-level nodes have TREETOP as parent.  Children are in decreasing
+ * order of attachment clock.
+ */
+enum { TREEACLK = 1, TREEPARENT, TREECHILD, TREENEXT, TREEPREV, TREEARRAYS };
+#define TREETOP ((modelclock_t)-1)
+
+static inline modelclock_t * treeLinks(const modelclock_t *clock, int which)
+{
+	return const_cast<modelclock_t *>(clock) + which * clockHeader(clock, CLOCKCAPACITY);
+}
+
+static modelclock_t * allocClocks(int num_threads)
+{
+	int capacity = paddedLength(num_threads > 0 ? num_threads : 1);
+	int length = CLOCKLANES + capacity * (treeClocks ? TREEARRAYS : 1);
+	modelclock_t *clock = (modelclock_t *)snapshot_memalign(CLOCKLANES * sizeof(modelclock_t), length * sizeof(modelclock_t));
+	std::memset(clock, 0, length * sizeof(modelclock_t));
+	clock += CLOCKLANES;
+	clockRefs(clock) = 1;
+	clockHeader(clock, CLOCKCAPACITY) = capacity;
+	clockHeader(clock, CLOCKTREE) = treeClocks;
+	return clock;
+}
+
+static void releaseClocks(modelclock_t *clock)
+{
+	if (--clockRefs(clock) == 0)
+		snapshot_free(clock - CLOCKLANES);
+}
+
+/** Copies the tree links of the first n threads of src to dst */
+static void copyTree(modelclock_t *dst, const modelclock_t *src, int n)
+{
+	if (!clockHeader(src, CLOCKTREE)) {
+		clockHeader(dst, CLOCKTREE) = false;
+		return;
+	}
+	for (int which = TREEACLK;which < TREEARRAYS;which++)
+		std::memcpy(treeLinks(dst, which), treeLinks(src, which), n * sizeof(modelclock_t));
+	clockHeader(dst, CLOCKTOP) = clockHeader(src, CLOCKTOP);
+}
+
+/** Takes node u, and the subtree under it, out of its parent's children */
+static void treeUnlink(modelclock_t *clock, int u)
+{
+	modelclock_t *parent = treeLinks(clock, TREEPARENT);
+	modelclock_t *next = treeLinks(clock, TREENEXT);
+	modelclock_t *prev = treeLinks(clock, TREEPREV);
+	if (prev[u])
+		next[prev[u] - 1] = next[u];
+	else if (parent[u] == TREETOP)
+		clockHeader(clock, CLOCKTOP) = next[u];
+	else
+		treeLinks(clock, TREECHILD)[parent[u] - 1] = next[u];
+	if (next[u])
+		prev[next[u] - 1] = prev[u];
+	parent[u] = next[u] = prev[u] = 0;
+}
+
+/** Makes node u the first child of node p, or a top-level node if p is -1 */
+static void treePushChild(modelclock_t *clock, int p, int u)
+{
+	modelclock_t &head = p < 0 ? clockHeader(clock, CLOCKTOP) : treeLinks(clock, TREECHILD)[p];
+	modelclock_t *prev = treeLinks(clock, TREEPREV);
+	treeLinks(clock, TREEPARENT)[u] = p < 0 ? TREETOP : p + 1;
+	treeLinks(clock, TREENEXT)[u] = head;
+	prev[u] = 0;
+	if (head)
+		prev[head - 1] = u + 1;
+	head = u + 1;
+}
+
+/** The nodes a tree merge updates, children before their parents; kept in
+ *  the snapshot heap, so that it goes with each execution */
+static int *treeUpdated;
+static int treeUpdatedCount;
+static int treeUpdatedCapacity;
+
+/**
+ * A merge kernel combines the first n clocks of other into clock and
+ * returns whether clock changed.  For the element-wise maximum, both arrays
+ * are aligned as allocClocks aligns them and n is a multiple of CLOCKLANES;
+ * the element-wise minimum takes any pointers into the arrays and any n.
+ */
+typedef bool (*clock_kernel_t)(modelclock_t *clock, const modelclock_t *other, int n);
+
+/**
+ * A dominance kernel returns the first multiple of CLOCKLANES from from on
+ * at which some of the next CLOCKLANES clocks of other are later than
+ * those of clock, or n if there is none.  The arrays are aligned as for
+ * the maximum and from and n are multiples of CLOCKLANES.
+ */
+typedef int (*dominates_kernel_t)(const modelclock_t *clock, const modelclock_t *other, int from, int n);
+
+static bool mergeScalar(modelclock_t *clock, const modelclock_t *other, int n)
+{
+	bool changed = false;
+	for (int i = 0;i < n;i++)
+		if (other[i] > clock[i]) {
+			clock[i] = other[i];
+			changed = true;
+		}
+	return changed;
+}
+
+static bool minmergeScalar(modelclock_t *clock, const modelclock_t *other, int n)
+{
+	bool changed = false;
+	for (int i = 0;i < n;i++)
+		if (other[i] < clock[i]) {
+			clock[i] = other[i];
+			changed = true;
+		}
+	return changed;
+}
+
+static int dominatesScalar(const modelclock_t *clock, const modelclock_t *other, int from, int n)
+{
+	for (int i = from;i < n;i += CLOCKLANES)
+		for (int j = i;j < i + CLOCKLANES;j++)
+			if (other[j] > clock[j])
+				return i;
+	return n;
+}
+
+#ifdef __x86_64__
+__attribute__((target("sse4.1")))
+static bool mergeSSE4(modelclock_t *clock, const modelclock_t *other, int n)
+{
+	bool changed = false;
+	for (int i = 0;i < n;i += 4) {
+		__m128i ours = _mm_load_si128((const __m128i *)&clock[i]);
+		__m128i merged = _mm_max_epu32(ours, _mm_load_si128((const __m128i *)&other[i]));
+		__m128i diff = _mm_xor_si128(merged, ours);
+		if (!_mm_testz_si128(diff, diff)) {
+			_mm_store_si128((__m128i *)&clock[i], merged);
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+__attribute__((target("sse4.1")))
+static bool minmergeSSE4(modelclock_t *clock, const modelclock_t *other, int n)
+{
+	bool changed = false;
+	int i = 0;
+	for (;i + 4 <= n;i += 4) {
+		__m128i ours = _mm_loadu_si128((const __m128i *)&clock[i]);
+		__m128i merged = _mm_min_epu32(ours, _mm_loadu_si128((const __m128i *)&other[i]));
+		__m128i diff = _mm_xor_si128(merged, ours);
+		if (!_mm_testz_si128(diff, diff)) {
+			_mm_storeu_si128((__m128i *)&clock[i], merged);
+			changed = true;
+		}
+	}
+	/* Clocks past n are real in clock but padding in other */
+	if (minmergeScalar(clock + i, other + i, n - i))
+		changed = true;
+	return changed;
+}
+
+__attribute__((target("sse4.1")))
+static int dominatesSSE4(const modelclock_t *clock, const modelclock_t *other, int from, int n)
+{
+	for (int i = from;i < n;i += 4) {
+		__m128i ours = _mm_load_si128((const __m128i *)&clock[i]);
+		__m128i diff = _mm_xor_si128(_mm_max_epu32(ours, _mm_load_si128((const __m128i *)&other[i])), ours);
+		if (!_mm_testz_si128(diff, diff))
+			return i & ~(CLOCKLANES - 1);
+	}
+	return n;
+}
+
+__attribute__((target("avx2")))
+static bool mergeAVX2(modelclock_t *clock, const modelclock_t *other, int n)
+{
+	bool changed = false;
+	for (int i = 0;i < n;i += 8) {
+		__m256i ours = _mm256_load_si256((const __m256i *)&clock[i]);
+		__m256i merged = _mm256_max_epu32(ours, _mm256_load_si256((const __m256i *)&other[i]));
+		__m256i diff = _mm256_xor_si256(merged, ours);
+		if (!_mm256_testz_si256(diff, diff)) {
+			_mm256_store_si256((__m256i *)&clock[i], merged);
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+__attribute__((target("avx2")))
+static bool minmergeAVX2(modelclock_t *clock, const modelclock_t *other, int n)
+{
+	bool changed = false;
+	int i = 0;
+	for (;i + 8 <= n;i += 8) {
+		__m256i ours = _mm256_loadu_si256((const __m256i *)&clock[i]);
+		__m256i merged = _mm256_min_epu32(ours, _mm256_loadu_si256((const __m256i *)&other[i]));
+		__m256i diff = _mm256_xor_si256(merged, ours);
+		if (!_mm256_testz_si256(diff, diff)) {
+			_mm256_storeu_si256((__m256i *)&clock[i], merged);
+			changed = true;
+		}
+	}
+	/* Clocks past n are real in clock but padding in other */
+	if (minmergeScalar(clock + i, other + i, n - i))
+		changed = true;
+	return changed;
+}
+
+__attribute__((target("avx2")))
+static int dominatesAVX2(const modelclock_t *clock, const modelclock_t *other, int from, int n)
+{
+	for (int i = from;i < n;i += 8) {
+		__m256i ours = _mm256_load_si256((const __m256i *)&clock[i]);
+		__m256i diff = _mm256_xor_si256(_mm256_max_epu32(ours, _mm256_load_si256((const __m256i *)&other[i])), ours);
+		if (!_mm256_testz_si256(diff, diff))
+			return i;
+	}
+	return n;
+}
+#endif
+
+static bool mergeResolve(modelclock_t *clock, const modelclock_t *other, int n);
+static bool minmergeResolve(modelclock_t *clock, const modelclock_t *other, int n);
+static int dominatesResolve(const modelclock_t *clock, const modelclock_t *other, int from, int n);
+
+/** The merge kernels for this processor; they start out as resolvers,
+ *  since clock vectors can be built before static constructors run */
+static clock_kernel_t mergeKernel = mergeResolve;
+static clock_kernel_t minmergeKernel = minmergeResolve;
+static dominates_kernel_t dominatesKernel = dominatesResolve;
+
+/** Picks the widest merge kernels that the processor supports */
+static void pickClockKernels()
+{
+	mergeKernel = mergeScalar;
+	minmergeKernel = minmergeScalar;
+	dominatesKernel = dominatesScalar;
+#ifdef __x86_64__
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		mergeKernel = mergeAVX2;
+		minmergeKernel = minmergeAVX2;
+		dominatesKernel = dominatesAVX2;
+	} else if (__builtin_cpu_supports("sse4.1")) {
+		mergeKernel = mergeSSE4;
+		minmergeKernel = minmergeSSE4;
+		dominatesKernel = dominatesSSE4;
+	}
+#endif
+}
+
+static bool mergeResolve(modelclock_t *clock, const modelclock_t *other, int n)
+{
+	pickClockKernels();
+	return mergeKernel(clock, other, n);
+}
+
+static bool minmergeResolve(modelclock_t *clock, const modelclock_t *other, int n)
+{
+	pickClockKernels();
+	return minmergeKernel(clock, other, n);
+}
+
+static int dominatesResolve(const modelclock_t *clock, const modelclock_t *other, int from, int n)
+{
+	pickClockKernels();
+	return dominatesKernel(clock, other, from, n);
+}
+
+/** @brief Pick the clock vector representation that params ask for */
+void initClockVectors(const struct model_params *params)
+{
+	treeClocks = params->treeclocks;
+}
+
+/** Start over in a new snapshot heap, which the scratch space of the
+ *  last one did not survive */
+void resetClockVectors()
+{
+	treeUpdated = NULL;
+	treeUpdatedCapacity = 0;
+}
+
 /**
  * Constructs a new ClockVector, given a parent ClockVector and a first
  * ModelAction. This constructor can assign appropriate default settings if no
@@ -16,24 +339,127 @@
  * same thread or the parent that created this thread)
  * @param act is an action with which to update the ClockVector
  */
-ClockVector::ClockVector(ClockVector *parent, const ModelAction *act)
+ClockVector::ClockVector(ClockVector *parent, const ModelAction *act, bool rooted)
 {
-	num_threads = act != NULL ? int_to_id(act->get_tid()) + 1 : 0;
+	int tid = act != NULL ? id_to_int(act->get_tid()) : -1;
+	num_threads = tid + 1;
 	if (parent && parent->num_threads > num_threads)
 		num_threads = parent->num_threads;
+	root = -1;
 
-	clock = (modelclock_t *)snapshot_calloc(num_threads, sizeof(int));
-	if (parent)
-		std::memcpy(clock, parent->clock, parent->num_threads * sizeof(modelclock_t));
+	if (parent && (act == NULL || (clockHeader(parent->clock, CLOCKTREE) ? parent->root == tid : parent->owner < 0 || parent->owner == tid))) {
+		/* Share the parent's clocks; the entry of act's thread is kept
+		   apart, so the two vectors differ in nothing else */
+		clock = parent->clock;
+		clockRefs(clock)++;
+		length = parent->length;
+		owner = parent->owner;
+		ownclock = parent->ownclock;
+		if (act != NULL)
+			root = parent->root;
+	} else {
+		length = num_threads;
+		clock = allocClocks(length);
+		owner = -1;
+		ownclock = 0;
+		if (parent) {
+			std::memcpy(clock, parent->clock, parent->length * sizeof(modelclock_t));
+			if (clockHeader(clock, CLOCKTREE))
+				copyTree(clock, parent->clock, parent->length);
+			if (parent->owner >= 0)
+				clock[parent->owner] = parent->ownclock;
+		}
+	}
 
-	if (act != NULL)
-		clock[id_to_int(act->get_tid())] = act->get_seq_number();
+	if (act != NULL) {
+		owner = tid;
+		ownclock = act->get_seq_number();
+		if (root != tid && clockHeader(clock, CLOCKTREE)) {
+			if (rooted)
+				reroot(tid);
+			else if (treeLinks(clock, TREEPARENT)[tid] == 0)
+				treePushChild(clock, -1, tid);
+		}
+	}
+}
+
+/**
+ * @brief Make thread tid's node the root of this vector's tree, with the
+ * former top-level nodes attached under it at its current clock
+ *
+ * The vector must be the knowledge of tid's action: whoever knows that
+ * action then knows everything under the root.
+ */
+void ClockVector::reroot(int tid)
+{
+	modelclock_t *aclk = treeLinks(clock, TREEACLK);
+	if (treeLinks(clock, TREEPARENT)[tid] != 0)
+		treeUnlink(clock, tid);
+	for (modelclock_t z;(z = clockHeader(clock, CLOCKTOP)) != 0;) {
+		treeUnlink(clock, z - 1);
+		aclk[z - 1] = ownclock;
+		treePushChild(clock, tid, z - 1);
+	}
+	treePushChild(clock, -1, tid);
+	root = tid;
 }
 
 /** @brief Destructor */
 ClockVector::~ClockVector()
 {
-	snapshot_free(clock);
+	releaseClocks(clock);
+}
+
+/**
+ * @brief Give this vector a clock array of its own with its own entry
+ * stored in it, so that the array can change
+ * @param newlength The number of threads the vector must be able to record
+ */
+void ClockVector::makePrivate(int newlength)
+{
+	if (newlength < num_threads)
+		newlength = num_threads;
+	if (clockRefs(clock) > 1 || paddedLength(newlength) > (int)clockHeader(clock, CLOCKCAPACITY)) {
+		modelclock_t *newclock = allocClocks(newlength);
+		std::memcpy(newclock, clock, length * sizeof(modelclock_t));
+		if (clockHeader(newclock, CLOCKTREE))
+			copyTree(newclock, clock, length);
+		releaseClocks(clock);
+		clock = newclock;
+	}
+	length = num_threads = newlength;
+	if (owner >= 0) {
+		clock[owner] = ownclock;
+		owner = -1;
+	}
+}
+
+/** @brief The clock of the thread with index threadid */
+inline modelclock_t ClockVector::clockOf(int threadid) const
+{
+	if (threadid == owner)
+		return ownclock;
+	if (threadid < length)
+		return clock[threadid];
+	return 0;
+}
+
+/** @return Whether merging cv into this vector would leave it unchanged */
+bool ClockVector::dominates(const ClockVector *cv) const
+{
+	if (cv->owner >= 0 && cv->ownclock > clockOf(cv->owner))
+		return false;
+	int common = paddedLength(cv->length < length ? cv->length : length);
+	/* The kernel sees the stale array entries of the owners, so check the
+	   lanes it flags against the real clocks */
+	for (int i = 0;(i = dominatesKernel(clock, cv->clock, i, common)) < common;i += CLOCKLANES)
+		for (int j = i;j < i + CLOCKLANES;j++)
+			if (j != cv->owner && cv->clock[j] > clockOf(j))
+				return false;
+	for (int i = common;i < cv->length;i++)
+		if (i != cv->owner && cv->clock[i] > clockOf(i))
+			return false;
+	return true;
 }
 
 /**
@@ -44,21 +470,22 @@ ClockVector::~ClockVector()
 bool ClockVector::merge(const ClockVector *cv)
 {
 	ASSERT(cv != NULL);
-	bool changed = false;
-	if (cv->num_threads > num_threads) {
-		clock = (modelclock_t *)snapshot_realloc(clock, cv->num_threads * sizeof(modelclock_t));
-		for (int i = num_threads;i < cv->num_threads;i++)
-			clock[i] = 0;
-		num_threads = cv->num_threads;
-	}
+	if (clockHeader(clock, CLOCKTREE) && clockHeader(cv->clock, CLOCKTREE))
+		return treeMerge(cv);
 
-	/* Element-wise maximum */
-	for (int i = 0;i < cv->num_threads;i++)
-		if (cv->clock[i] > clock[i]) {
-			clock[i] = cv->clock[i];
-			changed = true;
-		}
+	/* Keep sharing the clock array when there is nothing to merge */
+	if (dominates(cv))
+		return false;
+	makePrivate(cv->num_threads);
+	/* Our tree would not say what we learnt from a flat vector */
+	clockHeader(clock, CLOCKTREE) = false;
 
+	/* Element-wise maximum; the zero padding of cv leaves ours alone */
+	bool changed = mergeKernel(clock, cv->clock, paddedLength(cv->length));
+	if (cv->owner >= 0 && cv->ownclock > clock[cv->owner]) {
+		clock[cv->owner] = cv->ownclock;
+		changed = true;
+	}
 	return changed;
 }
 
@@ -70,24 +497,102 @@ bool ClockVector::merge(const ClockVector *cv)
 bool ClockVector::minmerge(const ClockVector *cv)
 {
 	ASSERT(cv != NULL);
-	bool changed = false;
-	if (cv->num_threads > num_threads) {
-		clock = (modelclock_t *)snapshot_realloc(clock, cv->num_threads * sizeof(modelclock_t));
-		for (int i = num_threads;i < cv->num_threads;i++)
-			clock[i] = 0;
-		num_threads = cv->num_threads;
-	}
+	makePrivate(cv->num_threads);
+	/* A minimum is no thread's knowledge, so it has no tree */
+	clockHeader(clock, CLOCKTREE) = false;
 
-	/* Element-wise minimum */
-	for (int i = 0;i < cv->num_threads;i++)
-		if (cv->clock[i] < clock[i]) {
-			clock[i] = cv->clock[i];
+	/* Element-wise minimum, around the stale entry of cv's owner */
+	int n = cv->length;
+	int skip = cv->owner >= 0 && cv->owner < n ? cv->owner : n;
+	bool changed = minmergeKernel(clock, cv->clock, skip);
+	if (skip < n && minmergeKernel(clock + skip + 1, cv->clock + skip + 1, n - skip - 1))
+		changed = true;
+	/* Past its array, cv's clocks are zero but for its own */
+	for (int i = n;i < cv->num_threads;i++) {
+		modelclock_t other = cv->clockOf(i);
+		if (other < clock[i]) {
+			clock[i] = other;
 			changed = true;
 		}
-
+	}
+	if (skip < n && cv->ownclock < clock[skip]) {
+		clock[skip] = cv->ownclock;
+		changed = true;
+	}
 	return changed;
 }
 
+/**
+ * @brief Join a tree clock into this one, in time proportional to the
+ * number of threads whose clocks change
+ *
+ * A node's subtree is what its thread knew when it had the node's clock,
+ * so the walk of cv's tree skips the subtrees of nodes we already know,
+ * and stops at the first child attached before the clock of its parent
+ * that we know.
+ */
+bool ClockVector::treeMerge(const ClockVector *cv)
+{
+	if (treeUpdatedCapacity < cv->length) {
+		if (treeUpdated != NULL)
+			snapshot_free(treeUpdated);
+		treeUpdatedCapacity = paddedLength(cv->length);
+		treeUpdated = (int *)snapshot_malloc(treeUpdatedCapacity * sizeof(int));
+	}
+	treeUpdatedCount = 0;
+	const modelclock_t *next = treeLinks(cv->clock, TREENEXT);
+	for (modelclock_t z = clockHeader(cv->clock, CLOCKTOP);z != 0;z = next[z - 1])
+		if (clockOf(z - 1) < cv->clockOf(z - 1))
+			collectUpdated(cv, z - 1);
+	if (treeUpdatedCount == 0)
+		return false;
+
+	makePrivate(cv->num_threads);
+	const modelclock_t *cvparent = treeLinks(cv->clock, TREEPARENT);
+	const modelclock_t *cvaclk = treeLinks(cv->clock, TREEACLK);
+	modelclock_t *parent = treeLinks(clock, TREEPARENT);
+	modelclock_t *aclk = treeLinks(clock, TREEACLK);
+	for (int i = 0;i < treeUpdatedCount;i++) {
+		int u = treeUpdated[i];
+		if (u != root && parent[u] != 0)
+			treeUnlink(clock, u);
+	}
+	/* Parents first, and siblings in increasing attachment order, as
+	   each is pushed to the front of its parent's children */
+	for (int i = treeUpdatedCount - 1;i >= 0;i--) {
+		int u = treeUpdated[i];
+		clock[u] = cv->clockOf(u);
+		if (u == root)
+			continue;
+		if (cvparent[u] != TREETOP) {
+			aclk[u] = cvaclk[u];
+			treePushChild(clock, cvparent[u] - 1, u);
+		} else if (root >= 0) {
+			aclk[u] = clock[root];
+			treePushChild(clock, root, u);
+		} else {
+			treePushChild(clock, -1, u);
+		}
+	}
+	return true;
+}
+
+/** @brief Record the nodes of cv's subtree under threadid that are later
+ *  than ours, threadid last */
+void ClockVector::collectUpdated(const ClockVector *cv, int threadid)
+{
+	const modelclock_t *aclk = treeLinks(cv->clock, TREEACLK);
+	const modelclock_t *next = treeLinks(cv->clock, TREENEXT);
+	modelclock_t known = clockOf(threadid);
+	for (modelclock_t v = treeLinks(cv->clock, TREECHILD)[threadid];v != 0;v = next[v - 1]) {
+		if (clockOf(v - 1) < cv->clockOf(v - 1))
+			collectUpdated(cv, v - 1);
+		else if (aclk[v - 1] <= known)
+			break;
+	}
+	treeUpdated[treeUpdatedCount++] = threadid;
+}
+
 /**
  * Check whether this vector's thread has synchronized with another action's
  * thread. This effectively checks the happens-before relation (or actually,
@@ -105,18 +610,13 @@ bool ClockVector::synchronized_since(const ModelAction *act) const
 	int i = id_to_int(act->get_tid());
 
 	if (i < num_threads)
-		return act->get_seq_number() <= clock[i];
+		return act->get_seq_number() <= clockOf(i);
 	return false;
 }
 
 /** Gets the clock corresponding to a given thread id from the clock vector. */
 modelclock_t ClockVector::getClock(thread_id_t thread) {
-	int threadid = id_to_int(thread);
-
-	if (threadid < num_threads)
-		return clock[threadid];
-	else
-		return 0;
+	return clockOf(id_to_int(thread));
 }
 
 /** @brief Formats and prints this ClockVector's data. */
@@ -125,5 +625,5 @@ void ClockVector::print() const
 	int i;
 	model_print("(");
 	for (i = 0;i < num_threads;i++)
-		model_print("%2u%s", clock[i], (i == num_threads - 1) ? ")\n" : ", ");
+		model_print("%2u%s", clockOf(i), (i == num_threads - 1) ? ")\n" : ", ");
 }
@@ -9,9 +9,14 @@
 #include "modeltypes.h"
 #include "classlist.h"
 
+struct model_params;
+
+void initClockVectors(const struct model_params *params);
+void resetClockVectors();
+
 class ClockVector {
 public:
-	ClockVector(ClockVector *parent = NULL, const ModelAction *act = NULL);
+	ClockVector(ClockVector *parent = NULL, const ModelAction *act = NULL, bool rooted = true);
 	~ClockVector();
 	bool merge(const ClockVector *cv);
 	bool minmerge(const ClockVector *cv);
@@ -22,11 +27,35 @@ public:
 
 	SNAPSHOTALLOC
 private:
-	/** @brief Holds the actual clock data, as an array. */
+	void makePrivate(int length);
+	bool dominates(const ClockVector *cv) const;
+	modelclock_t clockOf(int threadid) const;
+	bool treeMerge(const ClockVector *cv);
+	void collectUpdated(const ClockVector *cv, int threadid);
+	void reroot(int threadid);
+
+	/** @brief Holds the actual clock data, as an array aligned and padded
+	 *  with zeros for the vector merge kernels.  The array is reference
+	 *  counted and shared, unchanged, by the vectors of an action and its
+	 *  successors until a merge changes one of them. */
 	modelclock_t *clock;
 
-	/** @brief The number of threads recorded in clock (i.e., its length).  */
+	/** @brief The number of clocks in the clock array */
+	int length;
+
+	/** @brief The number of threads recorded in this vector */
 	int num_threads;
+
+	/** @brief The thread whose clock is ownclock, or -1.  Its entry in the
+	 *  clock array is stale, so that the array can be shared. */
+	int owner;
+
+	/** @brief The clock of owner, i.e., the seq number of its action */
+	modelclock_t ownclock;
+
+	/** @brief With tree clocks, the thread whose node all of this
+	 *  vector's knowledge hangs under, or -1 */
+	int root;
 };
 
 #endif	/* __CLOCKVECTOR_H__ */
@@ -55,9 +55,7 @@ VOLATILELOAD(64)
 		model->switch_thread(new ModelAction(ATOMIC_WRITE, position, memory_order_volatile_store, obj, (uint64_t) val)); \
 		*((volatile uint ## size ## _t *)obj) = val;            \
 		thread_id_t tid = thread_current_id();           \
-		for(int i=0;i < size / 8;i++) {                         \
-			atomraceCheckWrite(tid, (void *)(((char *)obj)+i));          \
-		}                                                       \
+		atomraceCheckWrite(tid, obj, size / 8);                   \
 	}
 
 VOLATILESTORE(8)
@@ -72,9 +70,7 @@ VOLATILESTORE(64)
 		model->switch_thread(new ModelAction(ATOMIC_INIT, position, memory_order_relaxed, obj, (uint64_t) val)); \
 		*((volatile uint ## size ## _t *)obj) = val;                                 \
 		thread_id_t tid = thread_current_id();           \
-		for(int i=0;i < size / 8;i++) {                       \
-			atomraceCheckWrite(tid, (void *)(((char *)obj)+i));          \
-		}                                                       \
+		atomraceCheckWrite(tid, obj, size / 8);                   \
 	}
 
 CDSATOMICINT(8)
@@ -89,9 +85,7 @@ CDSATOMICINT(64)
 		uint ## size ## _t val = (uint ## size ## _t)model->switch_thread( \
 			new ModelAction(ATOMIC_READ, position, orders[atomic_index], obj)); \
 		thread_id_t tid = thread_current_id();           \
-		for(int i=0;i < size / 8;i++) {                         \
-			atomraceCheckRead(tid, (void *)(((char *)obj)+i));    \
-		}                                                       \
+		atomraceCheckRead(tid, obj, size / 8);                    \
 		return val; \
 	}
 
@@ -107,9 +101,7 @@ CDSATOMICLOAD(64)
 		model->switch_thread(new ModelAction(ATOMIC_WRITE, position, orders[atomic_index], obj, (uint64_t) val)); \
 		*((volatile uint ## size ## _t *)obj) = val;                     \
 		thread_id_t tid = thread_current_id();           \
-		for(int i=0;i < size / 8;i++) {                       \
-			atomraceCheckWrite(tid, (void *)(((char *)obj)+i));          \
-		}                                                       \
+		atomraceCheckWrite(tid, obj, size / 8);                   \
 	}
 
 CDSATOMICSTORE(8)
@@ -127,10 +119,8 @@ CDSATOMICSTORE(64)
 		model_rmw_action_helper(addr, (uint64_t) _copy, atomic_index, position);        \
 		*((volatile uint ## size ## _t *)addr) = _copy;                  \
 		thread_id_t tid = thread_current_id();           \
-		for(int i=0;i < size / 8;i++) {                       \
-			atomraceCheckRead(tid,  (void *)(((char *)addr)+i));  \
-			recordWrite(tid, (void *)(((char *)addr)+i));         \
-		}                                                       \
+		atomraceCheckRead(tid, addr, size / 8);                 \
+		recordWrite(tid, addr, size / 8);                       \
 		return _old;                                            \
 	})
 
@@ -213,9 +203,7 @@ CDSATOMICXOR(64)
 			model_rmw_action_helper(addr, (uint64_t) _desired, atomic_index, position); \
 			*((volatile uint ## size ## _t *)addr) = desired;                        \
 			thread_id_t tid = thread_current_id();           \
-			for(int i=0;i < size / 8;i++) {                       \
-				recordWrite(tid, (void *)(((char *)addr)+i));         \
-			}                                                       \
+			recordWrite(tid, addr, size / 8);                         \
 			return _expected; }                                     \
 		else {                                                                                        \
 			model_rmwc_action_helper(addr, atomic_index, position); _expected = _old; return _old; }              \
@@ -285,6 +273,7 @@ void cds_atomic_thread_fence(int atomic_index, const char * position) {
 void cds_func_entry(const char * funcName) {
 #ifdef NEWFUZZER
 	createModelIfNotExist();
+	RACEQUIESCE();
 	thread_id_t tid = thread_current_id();
 	uint32_t func_id;
 
@@ -312,6 +301,7 @@ void cds_func_entry(const char * funcName) {
 void cds_func_exit(const char * funcName) {
 #ifdef NEWFUZZER
 	createModelIfNotExist();
+	RACEQUIESCE();
 	thread_id_t tid = thread_current_id();
 	uint32_t func_id;
 
@@ -329,3 +319,17 @@ void cds_func_exit(const char * funcName) {
 	history->exit_function(func_id, tid);
 #endif
 }
+
+void c11tester_checkpoint() {
+	/* The first call into the model checker is a checkpoint already */
+	if (!model) {
+		createModelIfNotExist();
+		return;
+	}
+	model->checkpoint();
+}
+
+void c11tester_set_reset_hook(void (*hook)()) {
+	createModelIfNotExist();
+	model->set_reset_hook(hook);
+}
@@ -11,6 +11,7 @@
 #include "model.h"
 #include "stacktrace.h"
 #include "output.h"
+#include "datarace.h"
 
 #define MAX_TRACE_LEN 100
 
@@ -43,6 +44,8 @@ void print_trace(void)
 void assert_hook(void)
 {
 	model_print("Add breakpoint to line %u in file %s.\n", __LINE__, __FILE__);
+	/* The run ends here, so report the races found so far */
+	printRaces();
 }
 
 void model_assert(bool expr, const char *file, int line)
@@ -51,6 +54,7 @@ void model_assert(bool expr, const char *file, int line)
 		char msg[100];
 		sprintf(msg, "Program has hit assertion in file %s at line %d\n",
 						file, line);
+		RACEQUIESCE();
 		model->assert_user_bug(msg);
 	}
 }
@@ -98,6 +102,18 @@ void redirect_output()
 
 }
 
+/** @brief Undo redirect_output(), so that it can be called again */
+void restore_output()
+{
+	fflush(stdout);
+	if (dup2(model_out, STDOUT_FILENO) < 0) {
+		perror("dup2");
+		exit(EXIT_FAILURE);
+	}
+	close(model_out);
+	model_out = STDOUT_FILENO;
+}
+
 /**
  * @brief Wrapper for reading data to buffer
  *
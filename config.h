@@ -37,6 +37,9 @@
 /** Page size configuration */
 #define PAGESIZE 4096
 
+/** Size of a transparent huge page, the alignment used with -H */
+#define HUGEPAGESIZE (2 * 1024 * 1024)
+
 #define TLS 1
 
 /** Thread parameters */
@@ -45,7 +48,52 @@
 #define STACK_SIZE (1024 * 1024)
 
 /** How many shadow tables of memory to preallocate for data race detector. */
-#define SHADOWBASETABLES 4
+#define SHADOWBASETABLES 32
+
+/** Size and address of the flat shadow region (-F).  It is reserved, not
+ *  committed; pages are populated as the race detector touches them. */
+#define FLATSHADOWSIZE (1ULL << 42)
+#define FLATSHADOWBASE ((void *)0x100000000000ULL)
+/** Minimum distance between the folded executable and stack addresses */
+#define FLATSHADOWGAP (1ULL << 38)
+
+/** Call sites tracked by sampled race checking (-R); a power of two */
+#define SAMPLESITES 4096
+/** Checks of a site at one sampling period before the period doubles */
+#define SAMPLEDECAY 64
+/** Accesses per execution for which --cold-site-full checks a site */
+#define SAMPLECOLD 16
+
+/** Size classes of pooled RaceRecord read sets, from twice the inline
+ *  capacity up; larger read sets use snapshot_malloc directly */
+#define READPOOLCLASSES 8
+/** Bytes the read set pool carves blocks from at a time */
+#define READPOOLCHUNK (64 * 1024)
+
+/** Races remembered to skip unwinding the stack for repeats; a power of
+ *  two */
+#define RACEFILTERSIZE 4096
+
+/** Most mo graph nodes that a location's partition allocates at a time;
+ *  its chunks start at one node and double up to this.  The chunks are
+ *  only freed with the partition, once every write to the location is
+ *  retired, and the collector keeps each location's mo-latest write */
+#define CYCLENODECHUNK 16
+/** Edges kept inside a mo graph node before the list spills to a pooled
+ *  array */
+#define CYCLEINLINEEDGES 2
+/** Size classes of pooled edge arrays, from twice the inline capacity up;
+ *  larger arrays use snapshot_malloc directly */
+#define CYCLEEDGECLASSES 8
+/** Bytes the edge pool carves arrays from at a time */
+#define CYCLEEDGECHUNK (16 * 1024)
+
+/** Plain accesses queued for the race helper thread (-A); a power of two */
+#define ASYNCRINGSIZE 4096
+/** Polls of the race helper queue before the waiting side yields or sleeps */
+#define ASYNCSPIN 256
+/** Stack size of the race helper thread; it also holds the thread's TLS */
+#define ASYNCSTACKSIZE (1024 * 1024)
 
 /** Enable debugging assertions (via ASSERT()) */
 #define CONFIG_ASSERT
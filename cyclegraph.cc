@@ -1,13 +1,27 @@
+#include <new>
+#include <string.h>
+
 #include "cyclegraph.h"
 #include "action.h"
 #include "common.h"
 #include "threads-model.h"
 #include "clockvector.h"
 
+/** Free lists of pooled edge arrays, by size class */
+static CycleNode **edgeFreeLists[CYCLEEDGECLASSES];
+/** The unused part of the chunk that edge arrays are carved from */
+static char *edgePoolBase;
+static char *edgePoolTop;
+
 /** Initializes a CycleGraph object. */
 CycleGraph::CycleGraph() :
+	partitions(64),
+	lastPartition(NULL),
 	queue(new SnapVector<const CycleNode *>())
 {
+	/* The pool of the last execution's graph went with its heap */
+	memset(edgeFreeLists, 0, sizeof(edgeFreeLists));
+	edgePoolBase = edgePoolTop = NULL;
 }
 
 /** CycleGraph destructor */
@@ -16,25 +30,31 @@ CycleGraph::~CycleGraph()
 	delete queue;
 }
 
-/**
- * Add a CycleNode to the graph, corresponding to a store ModelAction
- * @param act The write action that should be added
- * @param node The CycleNode that corresponds to the store
- */
-void CycleGraph::putNode(const ModelAction *act, CycleNode *node)
+/** @return The partition for the writes to location, if exists; otherwise
+ *  NULL */
+CyclePartition * CycleGraph::getPartition_noCreate(const void *location) const
 {
-	actionToNode.put(act, node);
-#if SUPPORT_MOD_ORDER_DUMP
-	nodeList.push_back(node);
-#endif
+	if (lastPartition != NULL && lastPartition->getLocation() == location)
+		return lastPartition;
+	CyclePartition *partition = partitions.get(location);
+	if (partition != NULL)
+		lastPartition = partition;
+	return partition;
 }
 
-/** @return The corresponding CycleNode, if exists; otherwise NULL */
-CycleNode * CycleGraph::getNode_noCreate(const ModelAction *act) const
+/** @return The partition for the writes to location, created if need be */
+CyclePartition * CycleGraph::getPartition(const void *location)
 {
-	return actionToNode.get(act);
+	CyclePartition *partition = getPartition_noCreate(location);
+	if (partition == NULL) {
+		partition = new CyclePartition(location);
+		partitions.put(location, partition);
+		lastPartition = partition;
+	}
+	return partition;
 }
 
+
 /**
  * @brief Returns the CycleNode corresponding to a given ModelAction
  *
@@ -45,10 +65,13 @@ CycleNode * CycleGraph::getNode_noCreate(const ModelAction *act) const
  */
 CycleNode * CycleGraph::getNode(ModelAction *action)
 {
-	CycleNode *node = getNode_noCreate(action);
+	CycleNode *node = action->get_cycle_node();
 	if (node == NULL) {
-		node = new CycleNode(action);
-		putNode(action, node);
+		node = getPartition(action->get_location())->newNode(action);
+		action->set_cycle_node(node);
+#if SUPPORT_MOD_ORDER_DUMP
+		nodeList.push_back(node);
+#endif
 	}
 	return node;
 }
@@ -290,8 +313,10 @@ bool CycleGraph::checkReachable(const ModelAction *from, const ModelAction *to)
 	return checkReachable(fromnode, tonode);
 }
 
-void CycleGraph::freeAction(const ModelAction * act) {
-	CycleNode *cn = actionToNode.remove(act);
+void CycleGraph::freeAction(ModelAction * act) {
+	CyclePartition *partition = getPartition_noCreate(act->get_location());
+	CycleNode *cn = act->get_cycle_node();
+	act->set_cycle_node(NULL);
 	for(unsigned int i=0;i<cn->edges.size();i++) {
 		CycleNode *dst = cn->edges[i];
 		dst->removeInEdge(cn);
@@ -300,7 +325,84 @@ void CycleGraph::freeAction(const ModelAction * act) {
 		CycleNode *src = cn->inedges[i];
 		src->removeEdge(cn);
 	}
-	delete cn;
+	partition->deleteNode(cn);
+
+	/* Once all of a location's writes are retired, drop its partition */
+	if (partition->isEmpty()) {
+		partitions.remove(partition->getLocation());
+		if (lastPartition == partition)
+			lastPartition = NULL;
+		delete partition;
+	}
+}
+
+/** A node slot; a free slot holds the next free slot */
+union CycleNodeSlot {
+	void *nextFree;
+	alignas(CycleNode) char node[sizeof(CycleNode)];
+};
+
+/** The header of a chunk of node slots; as many slots as the chunk was
+ *  allocated with follow it */
+struct alignas(CycleNodeSlot) CycleNodeChunk {
+	void *next;
+
+	CycleNodeSlot * getSlots() { return (CycleNodeSlot *)(this + 1); }
+};
+
+/**
+ * @brief Constructor for a CyclePartition
+ * @param location The location whose writes the partition orders
+ */
+CyclePartition::CyclePartition(const void *location) :
+	location(location),
+	chunks(NULL),
+	freeSlots(NULL),
+	numNodes(0),
+	chunkSlots(1)
+{
+}
+
+/** @brief Destructor; frees the node chunks at once */
+CyclePartition::~CyclePartition()
+{
+	while (chunks != NULL) {
+		CycleNodeChunk *chunk = (CycleNodeChunk *)chunks;
+		chunks = chunk->next;
+		snapshot_free(chunk);
+	}
+}
+
+/** @return A new CycleNode for act, in this partition's chunks */
+CycleNode * CyclePartition::newNode(ModelAction *act)
+{
+	if (freeSlots == NULL) {
+		/* Chunks double in size, so that locations with few writes stay
+		   small and hot ones get their nodes together */
+		CycleNodeChunk *chunk = (CycleNodeChunk *)snapshot_malloc(sizeof(CycleNodeChunk) + chunkSlots * sizeof(CycleNodeSlot));
+		chunk->next = chunks;
+		chunks = chunk;
+		CycleNodeSlot *slots = chunk->getSlots();
+		for (int i = chunkSlots - 1;i >= 0;i--) {
+			slots[i].nextFree = freeSlots;
+			freeSlots = &slots[i];
+		}
+		if (chunkSlots < CYCLENODECHUNK)
+			chunkSlots *= 2;
+	}
+	void *slot = freeSlots;
+	freeSlots = *(void **)slot;
+	numNodes++;
+	return new (slot) CycleNode(act);
+}
+
+/** @brief Destroys a node of this partition and reuses its slot */
+void CyclePartition::deleteNode(CycleNode *node)
+{
+	node->~CycleNode();
+	*(void **)node = freeSlots;
+	freeSlots = node;
+	numNodes--;
 }
 
 /**
@@ -310,7 +412,8 @@ void CycleGraph::freeAction(const ModelAction * act) {
 CycleNode::CycleNode(ModelAction *act) :
 	action(act),
 	hasRMW(NULL),
-	cv(new ClockVector(NULL, act))
+	/* Nodes keep learning after their vectors are merged elsewhere */
+	cv(new ClockVector(NULL, act, false))
 {
 }
 
@@ -368,6 +471,71 @@ unsigned int CycleNode::getNumInEdges() const
 	return inedges.size();
 }
 
+/** Returns the size class of a pooled edge array of the given capacity, a
+ *  power of two above CYCLEINLINEEDGES. */
+static inline int edgePoolClass(unsigned int capacity)
+{
+	return __builtin_ctz(capacity) - __builtin_ctz(CYCLEINLINEEDGES) - 1;
+}
+
+/** Allocates an edge array for capacity edges from the pool. */
+static CycleNode ** allocEdges(unsigned int capacity)
+{
+	int sizeclass = edgePoolClass(capacity);
+	if (sizeclass >= CYCLEEDGECLASSES)
+		return (CycleNode **)snapshot_malloc(sizeof(CycleNode *) * capacity);
+
+	CycleNode **block = edgeFreeLists[sizeclass];
+	if (block != NULL) {
+		edgeFreeLists[sizeclass] = *(CycleNode ***)block;
+		return block;
+	}
+	size_t size = sizeof(CycleNode *) * capacity;
+	if (edgePoolBase + size > edgePoolTop) {
+		edgePoolBase = (char *)snapshot_malloc(CYCLEEDGECHUNK);
+		edgePoolTop = edgePoolBase + CYCLEEDGECHUNK;
+	}
+	block = (CycleNode **)edgePoolBase;
+	edgePoolBase += size;
+	return block;
+}
+
+/** Returns an edge array for capacity edges to the pool. */
+static void freeEdges(CycleNode **block, unsigned int capacity)
+{
+	int sizeclass = edgePoolClass(capacity);
+	if (sizeclass >= CYCLEEDGECLASSES) {
+		snapshot_free(block);
+		return;
+	}
+	*(CycleNode ***)block = edgeFreeLists[sizeclass];
+	edgeFreeLists[sizeclass] = block;
+}
+
+/** @brief Appends an edge, spilling to a larger pooled array when full */
+void CycleEdges::push_back(CycleNode *node)
+{
+	if (num == capacity) {
+		CycleNode **grown = allocEdges(capacity * 2);
+		memcpy(grown, edges(), num * sizeof(CycleNode *));
+		if (capacity > CYCLEINLINEEDGES)
+			freeEdges(pooledEdges, capacity);
+		pooledEdges = grown;
+		capacity *= 2;
+	}
+	edges()[num++] = node;
+}
+
+/** @brief Removes all edges, returning a spilled array to the pool */
+void CycleEdges::clear()
+{
+	if (capacity > CYCLEINLINEEDGES) {
+		freeEdges(pooledEdges, capacity);
+		capacity = CYCLEINLINEEDGES;
+	}
+	num = 0;
+}
+
 /**
  * Adds an edge from this CycleNode to another CycleNode.
  * @param node The node to which we add a directed edge
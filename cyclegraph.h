@@ -3,7 +3,8 @@
  * @brief Data structure to track ordering constraints on modification order
  *
  * Used to determine whether a total order exists that satisfies the ordering
- * constraints.
+ * constraints.  Modification order only relates writes to the same location,
+ * so the graph is partitioned by location.
  */
 
 #ifndef __CYCLEGRAPH_H__
@@ -17,6 +18,35 @@
 #include "mymemory.h"
 #include "stl-model.h"
 #include "classlist.h"
+#include "action.h"
+
+/**
+ * @brief The edges into or out of a CycleNode
+ *
+ * Nearly all nodes have one or two edges each way, so the first
+ * CYCLEINLINEEDGES are kept in the list itself; longer lists spill to an
+ * array from a pool of size classes.
+ */
+class CycleEdges {
+public:
+	CycleEdges() : num(0), capacity(CYCLEINLINEEDGES) {}
+	~CycleEdges() { clear(); }
+	unsigned int size() const { return num; }
+	CycleNode *& operator[](unsigned int i) { return edges()[i]; }
+	CycleNode * operator[](unsigned int i) const { return const_cast<CycleEdges *>(this)->edges()[i]; }
+	void push_back(CycleNode *node);
+	void pop_back() { num--; }
+	void clear();
+private:
+	CycleNode ** edges() { return capacity > CYCLEINLINEEDGES ? pooledEdges : inlineEdges; }
+
+	unsigned int num;
+	unsigned int capacity;
+	union {
+		CycleNode *inlineEdges[CYCLEINLINEEDGES];
+		CycleNode **pooledEdges;
+	};
+};
 
 /** @brief A graph of Model Actions for tracking cycles. */
 class CycleGraph {
@@ -28,7 +58,7 @@ public:
 	void addEdge(ModelAction *from, ModelAction *to, bool forceedge);
 	void addRMWEdge(ModelAction *from, ModelAction *rmw);
 	bool checkReachable(const ModelAction *from, const ModelAction *to) const;
-	void freeAction(const ModelAction * act);
+	void freeAction(ModelAction * act);
 #if SUPPORT_MOD_ORDER_DUMP
 	void dumpNodes(FILE *file) const;
 	void dumpGraphToFile(const char *filename) const;
@@ -36,15 +66,21 @@ public:
 	void dot_print_edge(FILE *file, const ModelAction *from, const ModelAction *to, const char *prop);
 #endif
 
-	CycleNode * getNode_noCreate(const ModelAction *act) const;
+	CycleNode * getNode_noCreate(const ModelAction *act) const { return act->get_cycle_node(); }
 	SNAPSHOTALLOC
 private:
 	void addNodeEdge(CycleNode *fromnode, CycleNode *tonode, bool forceedge);
-	void putNode(const ModelAction *act, CycleNode *node);
+	CyclePartition * getPartition(const void *location);
+	CyclePartition * getPartition_noCreate(const void *location) const;
 	CycleNode * getNode(ModelAction *act);
 
-	/** @brief A table for mapping ModelActions to CycleNodes */
-	HashTable<const ModelAction *, CycleNode *, uintptr_t, 4> actionToNode;
+	/** @brief A table for mapping locations to their partitions */
+	HashTable<const void *, CyclePartition *, uintptr_t, 2> partitions;
+
+	/** @brief The partition last looked up, since consecutive operations
+	 *  mostly touch one location */
+	mutable CyclePartition *lastPartition;
+
 	SnapVector<const CycleNode *> * queue;
 
 #if SUPPORT_MOD_ORDER_DUMP
@@ -79,10 +115,10 @@ private:
 	ModelAction *action;
 
 	/** @brief The edges leading out from this node */
-	SnapVector<CycleNode *> edges;
+	CycleEdges edges;
 
 	/** @brief The edges leading in from this node */
-	SnapVector<CycleNode *> inedges;
+	CycleEdges inedges;
 
 	/** Pointer to a RMW node that reads from this node, or NULL, if none
 	 * exists */
@@ -93,4 +129,40 @@ private:
 	friend class CycleGraph;
 };
 
+/**
+ * @brief The nodes of a CycleGraph for the writes to one location
+ *
+ * The nodes are carved from chunks that the partition owns, so that a
+ * location's nodes sit together and go away with it.  A partition is only
+ * freed once all of its location's writes are retired.  The collector
+ * (-f/-m) keeps the mo-latest write of every location, so in practice a
+ * partition lives until the end of the execution.
+ */
+class CyclePartition {
+public:
+	CyclePartition(const void *location);
+	~CyclePartition();
+	CycleNode * newNode(ModelAction *act);
+	void deleteNode(CycleNode *node);
+	const void * getLocation() const { return location; }
+	bool isEmpty() const { return numNodes == 0; }
+
+	SNAPSHOTALLOC
+private:
+	/** @brief The location whose writes this partition orders */
+	const void *location;
+
+	/** @brief The chunks of node slots, linked through their first word */
+	void *chunks;
+
+	/** @brief The unused node slots, linked through their first word */
+	void *freeSlots;
+
+	/** @brief The number of nodes in the partition */
+	unsigned int numNodes;
+
+	/** @brief The number of slots in the next chunk */
+	int chunkSlots;
+};
+
 #endif	/* __CYCLEGRAPH_H__ */
@@ -9,12 +9,104 @@
 #include "action.h"
 #include "execution.h"
 #include "stl-model.h"
+#include "snapshot-interface.h"
 #include <execinfo.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <link.h>
+#include <elf.h>
+#include <sys/stat.h>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 static struct ShadowTable *root;
 static void *memory_base;
 static void *memory_top;
 static RaceSet * raceset;
+/** Counters of the race detector, in the shared heap so that they add up
+ *  over all executions */
+static struct race_stats *raceStats;
+#define RACESTAT(counter) (raceStats->counter++)
+/** Reported races, printed at the end of the run */
+static ModelVector<struct DataRace *> *reportedRaces;
+/** Keys of races already found, by call site, address and access kinds,
+ *  shared by all executions so that repeats skip the stack unwind */
+static uint64_t *raceFilter;
+/** Whether shadow tables are batched to fill huge pages (-H) */
+static bool hugetables;
+/** The flat shadow region (-F), or NULL when using shadow tables */
+static char *flatshadow;
+static size_t flatshadowsize;
+/** Whether shadow cells use the two-word layout (-W) */
+static bool wideshadow;
+/** Free lists of pooled read set blocks, by size class */
+static struct RaceRead *readFreeLists[READPOOLCLASSES];
+/** The unused part of the chunk that read set blocks are carved from */
+static char *readPoolBase;
+static char *readPoolTop;
+
+/** Sampling state of a call site (-R), shared by all executions */
+struct SampleSite {
+	const void *pc;
+	unsigned int period;	/**< Check one access in this many */
+	unsigned int countdown;	/**< Accesses left to skip before the next check */
+	unsigned int checks;	/**< Checks made at the current period */
+	bool raced;	/**< A race was reported here; always check it */
+};
+
+bool raceSampling;
+bool raceSkipStack;
+static bool coldSiteFull;
+static unsigned int maxSamplePeriod;
+static struct SampleSite *sampleSites;
+/** Accesses of each site in this execution, for --cold-site-full */
+static unsigned char *sampleColdCounts;
+
+/** A plain access queued for the race helper thread (-A) */
+struct RaceAccess {
+	const void *location;
+	const void *pc;	/**< Return address of the instrumented access */
+	size_t size;
+	thread_id_t thread;
+	bool iswrite;
+};
+
+bool raceAsync;
+static struct RaceAccess *asyncRing;
+/** Accesses queued and accesses checked; only user threads move asyncHead
+ *  and only the helper moves asyncTail */
+static unsigned int asyncHead __attribute__((aligned(64)));
+static unsigned int asyncTail __attribute__((aligned(64)));
+/** Whether the helper is asleep waiting for asyncHead to move */
+static unsigned int asyncSleeping __attribute__((aligned(64)));
+/** Whether this process has a helper thread; it does not survive a fork */
+static bool asyncStarted;
+/** Stack and attributes of the helper thread, set up once before the first
+ *  fork so that a forked execution only has to clone the thread */
+static pthread_attr_t asyncAttr;
+static bool asyncDraining;
+/** Races found by the helper, to be reported by the user thread */
+static ModelVector<struct DataRace *> *asyncRaces;
+static __thread bool asyncHelper;
+
+/** A range of code whose plain accesses are not race checked (-X) */
+struct SuppressRange {
+	uintptr_t start;
+	uintptr_t end;
+};
+
+unsigned char *suppressPages;
+/** Suppressed ranges, sorted and merged, for the pages that are partly
+ *  suppressed */
+static struct SuppressRange *suppressRanges;
+static unsigned int numSuppressRanges;
 
 #ifdef COLLECT_STAT
 static unsigned int store8_count = 0;
@@ -33,30 +125,476 @@ static const ModelExecution * get_execution()
 	return model->get_execution();
 }
 
+/** Preallocate a batch of zeroed shadow base tables. With -H the batch is
+ *  aligned so that it fills huge pages. */
+static void allocTableBatch()
+{
+	size_t size = sizeof(struct ShadowBaseTable) * SHADOWBASETABLES;
+	if (hugetables) {
+		memory_base = snapshot_memalign(HUGEPAGESIZE, size);
+		memset(memory_base, 0, size);
+	} else {
+		memory_base = snapshot_calloc(size, 1);
+	}
+	memory_top = ((char *)memory_base) + size;
+}
+
 /** This function initialized the data race detector. */
-void initRaceDetector()
+static void initShadowTables()
 {
 	root = (struct ShadowTable *)snapshot_calloc(sizeof(struct ShadowTable), 1);
-	memory_base = snapshot_calloc(sizeof(struct ShadowBaseTable) * SHADOWBASETABLES, 1);
-	memory_top = ((char *)memory_base) + sizeof(struct ShadowBaseTable) * SHADOWBASETABLES;
+	RACESTAT(shadow_tables);
+	raceStats->shadow_bytes += sizeof(struct ShadowTable);
+	allocTableBatch();
+}
+
+/**
+ * Maps the flat shadow region.  Application addresses are folded into it by
+ * their low bits, which keeps the executable and heap apart from the mmap
+ * area and stacks on the usual x86-64 Linux layout.
+ * @return false if the address space does not look like that
+ */
+static bool initFlatShadow(bool hugepages)
+{
+	int local;
+	uintptr_t image = ((uintptr_t)&root) & FLATSHADOWMASK;
+	uintptr_t stack = ((uintptr_t)&local) & FLATSHADOWMASK;
+	if (stack < image + FLATSHADOWGAP)
+		return false;
+
+	/* Wide cells take two words per granule */
+	size_t size = wideshadow ? 2 * FLATSHADOWSIZE : FLATSHADOWSIZE;
+	void *base = mmap(FLATSHADOWBASE, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0);
+	if (base != FLATSHADOWBASE) {
+		if (base != MAP_FAILED)
+			munmap(base, size);
+		return false;
+	}
+	if (hugepages)
+		madvise(base, size, MADV_HUGEPAGE);
+	flatshadowsize = size;
+	flatshadow = (char *)base;
+	return true;
+}
+
+/** Sets up sampled race checking (-R) */
+static void initRaceSampling(const struct model_params *params)
+{
+	raceSampling = true;
+	coldSiteFull = params->coldsitefull;
+	maxSamplePeriod = (unsigned int)(1.0 / params->racesample);
+	sampleSites = (struct SampleSite *)model_calloc(SAMPLESITES, sizeof(struct SampleSite));
+	sampleColdCounts = (unsigned char *)snapshot_calloc(SAMPLESITES, 1);
+}
+
+/** The patterns of a suppression file (-X) */
+struct SuppressPatterns {
+	ModelVector<char *> functions;
+	ModelVector<char *> objects;
+	ModelVector<struct SuppressRange> *ranges;
+};
+
+static bool suppressRangeLess(const struct SuppressRange &a, const struct SuppressRange &b)
+{
+	return a.start < b.start;
+}
+
+/** Adds the functions of an ELF file that match a fun: pattern */
+static void suppressFunctions(const char *path, uintptr_t bias, struct SuppressPatterns *patterns)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return;
+	struct stat st;
+	void *map = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(Elf64_Ehdr))
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return;
+
+	const char *file = (const char *)map;
+	const Elf64_Ehdr *ehdr = (const Elf64_Ehdr *)map;
+	if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 || ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+			ehdr->e_shoff + (size_t)ehdr->e_shnum * sizeof(Elf64_Shdr) > (size_t)st.st_size) {
+		munmap(map, st.st_size);
+		return;
+	}
+	const Elf64_Shdr *sections = (const Elf64_Shdr *)(file + ehdr->e_shoff);
+	for (unsigned int i = 0;i < ehdr->e_shnum;i++) {
+		const Elf64_Shdr *symtab = &sections[i];
+		if ((symtab->sh_type != SHT_SYMTAB && symtab->sh_type != SHT_DYNSYM) || symtab->sh_link >= ehdr->e_shnum)
+			continue;
+		const Elf64_Shdr *strtab = &sections[symtab->sh_link];
+		if (symtab->sh_offset + symtab->sh_size > (size_t)st.st_size || strtab->sh_offset + strtab->sh_size > (size_t)st.st_size)
+			continue;
+		const Elf64_Sym *syms = (const Elf64_Sym *)(file + symtab->sh_offset);
+		size_t numsyms = symtab->sh_size / sizeof(Elf64_Sym);
+		for (size_t j = 0;j < numsyms;j++) {
+			const Elf64_Sym *sym = &syms[j];
+			int type = ELF64_ST_TYPE(sym->st_info);
+			if ((type != STT_FUNC && type != STT_GNU_IFUNC) || sym->st_shndx == SHN_UNDEF || sym->st_size == 0 || sym->st_name >= strtab->sh_size)
+				continue;
+			const char *name = file + strtab->sh_offset + sym->st_name;
+			for (uint k = 0;k < patterns->functions.size();k++) {
+				if (fnmatch(patterns->functions[k], name, 0) == 0) {
+					struct SuppressRange range = { bias + sym->st_value, bias + sym->st_value + sym->st_size };
+					patterns->ranges->push_back(range);
+					break;
+				}
+			}
+		}
+	}
+	munmap(map, st.st_size);
+}
+
+/** Adds the suppressed code of one loaded object */
+static int suppressObject(struct dl_phdr_info *info, size_t size, void *data)
+{
+	struct SuppressPatterns *patterns = (struct SuppressPatterns *)data;
+	char exe[PATH_MAX];
+	const char *path = info->dlpi_name;
+	if (path[0] == 0) {
+		/* The program itself */
+		ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+		if (len < 0)
+			return 0;
+		exe[len] = 0;
+		path = exe;
+	}
+
+	for (uint i = 0;i < patterns->objects.size();i++) {
+		if (fnmatch(patterns->objects[i], path, 0) != 0)
+			continue;
+		for (int j = 0;j < info->dlpi_phnum;j++) {
+			const ElfW(Phdr) *phdr = &info->dlpi_phdr[j];
+			if (phdr->p_type == PT_LOAD && (phdr->p_flags & PF_X)) {
+				struct SuppressRange range = { info->dlpi_addr + phdr->p_vaddr, info->dlpi_addr + phdr->p_vaddr + phdr->p_memsz };
+				patterns->ranges->push_back(range);
+			}
+		}
+		break;
+	}
+	if (patterns->functions.size() != 0 && path[0] == '/')
+		suppressFunctions(path, info->dlpi_addr, patterns);
+	return 0;
+}
+
+/** Marks the pages of a suppressed range in suppressPages */
+static void markSuppressedPages(uintptr_t start, uintptr_t end)
+{
+	for (uintptr_t page = start >> SUPPRESSPAGESHIFT;page <= (end - 1) >> SUPPRESSPAGESHIFT;page++) {
+		bool whole = (page << SUPPRESSPAGESHIFT) >= start && ((page + 1) << SUPPRESSPAGESHIFT) <= end;
+		suppressPages[page >> 2] |= (whole ? SUPPRESSWHOLE : SUPPRESSPARTIAL) << ((page & 3) * 2);
+	}
+}
+
+/**
+ * @brief Loads a suppression file (-X)
+ *
+ * Each line is one of fun:PATTERN, for functions whose symbol matches,
+ * obj:PATTERN, for the code of loaded objects whose path matches, or
+ * addr:START-END, for a range of addresses as in /proc/self/maps.
+ * Patterns are shell wildcards; blank lines and lines starting with '#'
+ * are ignored.  The code is compiled into suppressPages, so that an access
+ * from suppressed code skips its race check after one lookup.
+ */
+static void loadSuppressions(const char *filename)
+{
+	FILE *file = fopen(filename, "r");
+	if (file == NULL) {
+		perror(filename);
+		exit(EXIT_FAILURE);
+	}
+	struct SuppressPatterns patterns;
+	patterns.ranges = new ModelVector<struct SuppressRange>();
+	char line[1024];
+	int lineno = 0;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		lineno++;
+		size_t len = strlen(line);
+		while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == ' ' || line[len - 1] == '\t'))
+			line[--len] = 0;
+		if (len == 0 || line[0] == '#')
+			continue;
+		struct SuppressRange range;
+		if (strncmp(line, "fun:", 4) == 0 && line[4] != 0) {
+			patterns.functions.push_back(strcpy((char *)model_malloc(len - 3), line + 4));
+		} else if (strncmp(line, "obj:", 4) == 0 && line[4] != 0) {
+			patterns.objects.push_back(strcpy((char *)model_malloc(len - 3), line + 4));
+		} else if (sscanf(line, "addr:%lx-%lx", &range.start, &range.end) == 2 && range.start < range.end) {
+			patterns.ranges->push_back(range);
+		} else {
+			model_print("%s:%d: bad suppression: %s\n", filename, lineno, line);
+			exit(EXIT_FAILURE);
+		}
+	}
+	fclose(file);
+	if (patterns.functions.size() != 0 || patterns.objects.size() != 0)
+		dl_iterate_phdr(suppressObject, &patterns);
+
+	void *pages = mmap(NULL, SUPPRESSPAGESSIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (pages == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	suppressPages = (unsigned char *)pages;
+
+	/* Sort and merge the ranges for raceSuppressedSite */
+	ModelVector<struct SuppressRange> *ranges = patterns.ranges;
+	if (ranges->size() != 0)
+		std::sort(&(*ranges)[0], &(*ranges)[0] + ranges->size(), suppressRangeLess);
+	suppressRanges = (struct SuppressRange *)model_malloc(sizeof(struct SuppressRange) * (ranges->size() + 1));
+	numSuppressRanges = 0;
+	for (uint i = 0;i < ranges->size();i++) {
+		struct SuppressRange range = (*ranges)[i];
+		if (range.start >= SUPPRESSADDRESSLIMIT)
+			continue;
+		if (range.end > SUPPRESSADDRESSLIMIT)
+			range.end = SUPPRESSADDRESSLIMIT;
+		markSuppressedPages(range.start, range.end);
+		if (numSuppressRanges != 0 && range.start <= suppressRanges[numSuppressRanges - 1].end) {
+			if (range.end > suppressRanges[numSuppressRanges - 1].end)
+				suppressRanges[numSuppressRanges - 1].end = range.end;
+		} else {
+			suppressRanges[numSuppressRanges++] = range;
+		}
+	}
+	for (uint i = 0;i < patterns.functions.size();i++)
+		model_free(patterns.functions[i]);
+	for (uint i = 0;i < patterns.objects.size();i++)
+		model_free(patterns.objects[i]);
+	delete ranges;
+}
+
+/** Whether the code at pc, on a page that is partly suppressed, is
+ *  suppressed (-X) */
+bool raceSuppressedSite(const void *pc)
+{
+	uintptr_t addr = (uintptr_t)pc;
+	unsigned int low = 0, high = numSuppressRanges;
+	while (low < high) {
+		unsigned int mid = (low + high) / 2;
+		if (addr < suppressRanges[mid].start)
+			high = mid;
+		else if (addr >= suppressRanges[mid].end)
+			low = mid + 1;
+		else
+			return true;
+	}
+	return false;
+}
+
+static void raceAsyncForked()
+{
+	asyncStarted = false;
+	asyncSleeping = 0;
+}
+
+/** Sets up race checking on a helper thread (-A).  A process starts its
+ *  helper when it first queues an access and keeps it for the rest of its
+ *  executions; a forked execution starts its own on the inherited stack. */
+static void initRaceAsync()
+{
+	void *ring = mmap(NULL, sizeof(struct RaceAccess) * ASYNCRINGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	void *stack = mmap(NULL, ASYNCSTACKSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+	if (ring == MAP_FAILED || stack == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	asyncRing = (struct RaceAccess *)ring;
+	pthread_attr_init(&asyncAttr);
+	pthread_attr_setstack(&asyncAttr, stack, ASYNCSTACKSIZE);
+	asyncRaces = new ModelVector<struct DataRace *>();
+	pthread_atfork(NULL, NULL, raceAsyncForked);
+	raceAsync = true;
+}
+
+void initRaceDetector(const struct model_params *params)
+{
+	raceStats = (struct race_stats *)model_calloc(1, sizeof(struct race_stats));
+	hugetables = params->hugepages;
+	wideshadow = params->wideshadow;
+	raceSkipStack = params->skipstack;
+	if (params->suppressions)
+		loadSuppressions(params->suppressions);
+	if (params->racesample < 1.0)
+		initRaceSampling(params);
+	if (params->flatshadow) {
+		if (params->softdirty)
+			model_print("Flat shadow memory does not work with -s; using shadow tables\n");
+		else if (!initFlatShadow(params->hugepages))
+			model_print("Cannot map flat shadow memory here; using shadow tables\n");
+	}
+	if (!flatshadow)
+		initShadowTables();
+	if (params->asyncrace) {
+		if (params->softdirty)
+			model_print("Asynchronous race checks do not work with -s; checking inline\n");
+		else
+			initRaceAsync();
+	}
 	raceset = new RaceSet();
+	reportedRaces = new ModelVector<struct DataRace *>();
+	raceFilter = (uint64_t *)model_calloc(RACEFILTERSIZE, sizeof(uint64_t));
+}
+
+/** @return The race detector's counters over all executions so far */
+const struct race_stats * getRaceStats()
+{
+	return raceStats;
+}
+
+/** Start over with empty shadow memory in a new snapshot heap; races
+ *  already reported stay reported */
+void resetRaceDetector()
+{
+	RACEQUIESCE();
+	if (raceSampling)
+		sampleColdCounts = (unsigned char *)snapshot_calloc(SAMPLESITES, 1);
+	if (flatshadow)
+		madvise(flatshadow, flatshadowsize, MADV_DONTNEED);
+	else
+		initShadowTables();
+	memset(readFreeLists, 0, sizeof(readFreeLists));
+	readPoolBase = readPoolTop = NULL;
 }
 
 void * table_calloc(size_t size)
 {
+	RACESTAT(shadow_tables);
+	raceStats->shadow_bytes += size;
 	if ((((char *)memory_base) + size) > memory_top) {
-		return snapshot_calloc(size, 1);
-	} else {
-		void *tmp = memory_base;
-		memory_base = ((char *)memory_base) + size;
-		return tmp;
+		if (!hugetables)
+			return snapshot_calloc(size, 1);
+		allocTableBatch();
+	}
+	void *tmp = memory_base;
+	memory_base = ((char *)memory_base) + size;
+	return tmp;
+}
+
+/**
+ * Layouts of a shadow cell, which shadows one granule or one byte of a
+ * split granule.  The first word of a cell is zero when nothing accessed
+ * it, a RaceRecord or split granule pointer, or a compact record with its
+ * low bit set; any other words are zero unless it is a compact record.
+ */
+
+/** One word in the ENCODEOP layout */
+struct NarrowCell {
+	static const int WORDS = 1;
+
+	static bool fits(int threadid, modelclock_t clock) {
+		return threadid <= MAXTHREADID && clock <= MAXWRITEVECTOR;
+	}
+	static modelclock_t readClock(const uint64_t *cell) { return READVECTOR(cell[0]); }
+	static int readThread(const uint64_t *cell) { return RDTHREADID(cell[0]); }
+	static modelclock_t writeClock(const uint64_t *cell) { return WRITEVECTOR(cell[0]); }
+	static int writeThread(const uint64_t *cell) { return WRTHREADID(cell[0]); }
+	static bool isAtomic(const uint64_t *cell) { return cell[0] & ATOMICMASK; }
+	static void setAtomic(uint64_t *cell) { cell[0] |= ATOMICMASK; }
+
+	static void encode(uint64_t *cell, int rdthread, modelclock_t rdclock, int wrthread, modelclock_t wrclock, bool atomic) {
+		cell[0] = ENCODEOP(rdthread, rdclock, wrthread, wrclock) | (atomic ? ATOMICMASK : 0);
+	}
+
+	/** Whether the cell holds nothing but a write by wrthread at wrclock */
+	static bool isWrite(const uint64_t *cell, int wrthread, modelclock_t wrclock, bool atomic) {
+		return cell[0] == (ENCODEOP(0, 0, wrthread, wrclock) | (atomic ? ATOMICMASK : 0));
+	}
+
+	/** Counts how many of the first count cells equal cell. */
+	static size_t match(const uint64_t *cells, size_t count, const uint64_t *cell) {
+		uint64_t val = cell[0];
+		size_t i = 0;
+#ifdef __SSE2__
+		__m128i pattern = _mm_set1_epi64x(val);
+		for (;i + 2 <= count;i += 2) {
+			int mask = _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)&cells[i]), pattern));
+			if (mask != 0xffff)
+				return ((mask & 0xff) == 0xff) ? i + 1 : i;
+		}
+#endif
+		while (i < count && cells[i] == val)
+			i++;
+		return i;
 	}
+};
+
+/** Two words in the WIDEENCODE layout (-W) */
+struct WideCell {
+	static const int WORDS = 2;
+
+	static bool fits(int threadid, modelclock_t clock) {
+		return threadid <= MAXWIDETHREADID && clock <= MAXWIDEVECTOR;
+	}
+	static modelclock_t readClock(const uint64_t *cell) { return WIDEREADVECTOR(cell[0]); }
+	static int readThread(const uint64_t *cell) { return WIDERDTHREADID(cell[0]); }
+	static modelclock_t writeClock(const uint64_t *cell) { return WIDEWRITEVECTOR(cell[1]); }
+	static int writeThread(const uint64_t *cell) { return WIDEWRTHREADID(cell[1]); }
+	static bool isAtomic(const uint64_t *cell) { return cell[1] & ATOMICMASK; }
+	static void setAtomic(uint64_t *cell) { cell[1] |= ATOMICMASK; }
+
+	static void encode(uint64_t *cell, int rdthread, modelclock_t rdclock, int wrthread, modelclock_t wrclock, bool atomic) {
+		cell[0] = WIDEENCODEREAD(rdthread, rdclock);
+		cell[1] = WIDEENCODEWRITE(wrthread, wrclock) | (atomic ? ATOMICMASK : 0);
+	}
+
+	/** Whether the cell holds nothing but a write by wrthread at wrclock */
+	static bool isWrite(const uint64_t *cell, int wrthread, modelclock_t wrclock, bool atomic) {
+		return cell[0] == WIDEENCODEREAD(0, 0) && cell[1] == (WIDEENCODEWRITE(wrthread, wrclock) | (atomic ? ATOMICMASK : 0));
+	}
+
+	/** Counts how many of the first count cells equal cell. */
+	static size_t match(const uint64_t *cells, size_t count, const uint64_t *cell) {
+		size_t i = 0;
+#ifdef __SSE2__
+		__m128i pattern = _mm_loadu_si128((const __m128i *)cell);
+		while (i < count && _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)&cells[i * WORDS]), pattern)) == 0xffff)
+			i++;
+#else
+		while (i < count && cells[i * WORDS] == cell[0] && cells[i * WORDS + 1] == cell[1])
+			i++;
+#endif
+		return i;
+	}
+};
+
+template <class Cell>
+static inline bool cellEquals(const uint64_t *cell1, const uint64_t *cell2)
+{
+	for (int i = 0;i < Cell::WORDS;i++) {
+		if (cell1[i] != cell2[i])
+			return false;
+	}
+	return true;
+}
+
+template <class Cell>
+static inline void copyCell(uint64_t *dst, const uint64_t *src)
+{
+	for (int i = 0;i < Cell::WORDS;i++)
+		dst[i] = src[i];
+}
+
+/** Makes a cell hold a RaceRecord or split granule pointer. */
+template <class Cell>
+static inline void setCellPointer(uint64_t *cell, uint64_t ptr)
+{
+	cell[0] = ptr;
+	for (int i = 1;i < Cell::WORDS;i++)
+		cell[i] = 0;
 }
 
-/** This function looks up the entry in the shadow table corresponding to a
+/** This function looks up the shadow cell of the granule containing a
  * given address.*/
-static inline uint64_t * lookupAddressEntry(const void *address)
+template <class Cell>
+static inline uint64_t * lookupGranuleEntry(const void *address)
 {
+	if (flatshadow)
+		return (uint64_t *)(flatshadow + (((uintptr_t)address) & FLATSHADOWMASK) * Cell::WORDS);
+
 	struct ShadowTable *currtable = root;
 #if BIT48
 	currtable = (struct ShadowTable *) currtable->array[(((uintptr_t)address) >> 32) & MASK16BIT];
@@ -67,18 +605,129 @@ static inline uint64_t * lookupAddressEntry(const void *address)
 
 	struct ShadowBaseTable *basetable = (struct ShadowBaseTable *)currtable->array[(((uintptr_t)address) >> 16) & MASK16BIT];
 	if (basetable == NULL) {
-		basetable = (struct ShadowBaseTable *)(currtable->array[(((uintptr_t)address) >> 16) & MASK16BIT] = table_calloc(sizeof(struct ShadowBaseTable)));
+		basetable = (struct ShadowBaseTable *)(currtable->array[(((uintptr_t)address) >> 16) & MASK16BIT] = table_calloc(sizeof(struct ShadowBaseTable) * Cell::WORDS));
 	}
-	return &basetable->array[((uintptr_t)address) & MASK16BIT];
+	return basetable->array + ((((uintptr_t)address) & MASK16BIT) >> GRANULESHIFT) * Cell::WORDS;
+}
+
+/** Returns the size class of a pooled read set of the given capacity, a
+ *  power of two above INITCAPACITY. */
+static inline int readPoolClass(int capacity)
+{
+	return __builtin_ctz(capacity) - __builtin_ctz(INITCAPACITY) - 1;
 }
 
+/** Allocates a read set block for capacity reads from the pool. */
+static struct RaceRead * allocReads(int capacity)
+{
+	int sizeclass = readPoolClass(capacity);
+	if (sizeclass >= READPOOLCLASSES)
+		return (struct RaceRead *)snapshot_malloc(sizeof(struct RaceRead) * capacity);
+
+	struct RaceRead *block = readFreeLists[sizeclass];
+	if (block != NULL) {
+		readFreeLists[sizeclass] = *(struct RaceRead **)block;
+		return block;
+	}
+	size_t size = sizeof(struct RaceRead) * capacity;
+	if (readPoolBase + size > readPoolTop) {
+		readPoolBase = (char *)snapshot_malloc(READPOOLCHUNK);
+		readPoolTop = readPoolBase + READPOOLCHUNK;
+	}
+	block = (struct RaceRead *)readPoolBase;
+	readPoolBase += size;
+	return block;
+}
 
-bool hasNonAtomicStore(const void *address) {
-	uint64_t * shadow = lookupAddressEntry(address);
+/** Returns a read set block for capacity reads to the pool. */
+static void freeReads(struct RaceRead *block, int capacity)
+{
+	int sizeclass = readPoolClass(capacity);
+	if (sizeclass >= READPOOLCLASSES) {
+		snapshot_free(block);
+		return;
+	}
+	*(struct RaceRead **)block = readFreeLists[sizeclass];
+	readFreeLists[sizeclass] = block;
+}
+
+/** Returns the read set of a full record. */
+static inline struct RaceRead * recordReads(struct RaceRecord *record)
+{
+	return record->capacity > INITCAPACITY ? record->pooledReads : record->inlineReads;
+}
+
+/** Makes a private copy of a full record, for a granule that is split. */
+static struct RaceRecord * copyRecord(struct RaceRecord *record)
+{
+	struct RaceRecord *copy = (struct RaceRecord *)snapshot_malloc(sizeof(struct RaceRecord));
+	*copy = *record;
+	if (record->capacity > INITCAPACITY) {
+		copy->pooledReads = allocReads(record->capacity);
+		std::memcpy(copy->pooledReads, record->pooledReads, record->numReads * sizeof(struct RaceRead));
+	}
+	return copy;
+}
+
+/** Splits a granule into per-byte shadow cells, each starting out with the
+ *  state of the whole granule.  Returns the per-byte cells. */
+template <class Cell>
+static uint64_t * splitGranule(uint64_t *granule)
+{
+	RACESTAT(split_granules);
+	uint64_t granuleval = granule[0];
+	uint64_t *bytes = (uint64_t *)snapshot_malloc(sizeof(uint64_t) * GRANULESIZE * Cell::WORDS);
+	copyCell<Cell>(bytes, granule);
+	for (int i = 1;i < GRANULESIZE;i++) {
+		if (granuleval != 0 && !ISSHORTRECORD(granuleval))
+			setCellPointer<Cell>(&bytes[i * Cell::WORDS], (uint64_t) copyRecord((struct RaceRecord *)granuleval));
+		else
+			copyCell<Cell>(&bytes[i * Cell::WORDS], granule);
+	}
+	setCellPointer<Cell>(granule, SPLITGRANULE(bytes));
+	return bytes;
+}
+
+/** Collapses a split granule back into a single shadow cell if all of its
+ *  bytes ended up with the same compact record. */
+template <class Cell>
+static void collapseGranule(uint64_t *granule)
+{
+	uint64_t *bytes = GRANULEBYTES(granule[0]);
+	if (bytes[0] != 0 && !ISSHORTRECORD(bytes[0]))
+		return;
+	for (int i = 1;i < GRANULESIZE;i++) {
+		if (!cellEquals<Cell>(&bytes[i * Cell::WORDS], bytes))
+			return;
+	}
+	copyCell<Cell>(granule, bytes);
+	snapshot_free(bytes);
+}
+
+/** This function looks up the shadow cell describing the byte at a given
+ * address.  If forupdate is set, the granule is split so that the cell
+ * only describes that byte. */
+template <class Cell>
+static inline uint64_t * lookupAddressEntry(const void *address, bool forupdate)
+{
+	uint64_t *granule = lookupGranuleEntry<Cell>(address);
+	uint64_t *bytes;
+	if (ISSPLITGRANULE(granule[0]))
+		bytes = GRANULEBYTES(granule[0]);
+	else if (forupdate)
+		bytes = splitGranule<Cell>(granule);
+	else
+		return granule;
+	return &bytes[(((uintptr_t)address) & GRANULEMASK) * Cell::WORDS];
+}
+
+template <class Cell>
+static bool cellHasNonAtomicStore(const void *address) {
+	uint64_t * shadow = lookupAddressEntry<Cell>(address, false);
 	uint64_t shadowval = *shadow;
 	if (ISSHORTRECORD(shadowval)) {
 		//Do we have a non atomic write with a non-zero clock
-		return !(ATOMICMASK & shadowval);
+		return !Cell::isAtomic(shadow);
 	} else {
 		if (shadowval == 0)
 			return true;
@@ -87,14 +736,21 @@ bool hasNonAtomicStore(const void *address) {
 	}
 }
 
-void setAtomicStoreFlag(const void *address) {
-	uint64_t * shadow = lookupAddressEntry(address);
+bool hasNonAtomicStore(const void *address) {
+	if (wideshadow)
+		return cellHasNonAtomicStore<WideCell>(address);
+	return cellHasNonAtomicStore<NarrowCell>(address);
+}
+
+template <class Cell>
+static void cellSetAtomicStoreFlag(const void *address) {
+	uint64_t * shadow = lookupAddressEntry<Cell>(address, true);
 	uint64_t shadowval = *shadow;
 	if (ISSHORTRECORD(shadowval)) {
-		*shadow = shadowval | ATOMICMASK;
+		Cell::setAtomic(shadow);
 	} else {
 		if (shadowval == 0) {
-			*shadow = ATOMICMASK | ENCODEOP(0, 0, 0, 0);
+			Cell::encode(shadow, 0, 0, 0, 0, true);
 			return;
 		}
 		struct RaceRecord *record = (struct RaceRecord *)shadowval;
@@ -102,13 +758,21 @@ void setAtomicStoreFlag(const void *address) {
 	}
 }
 
-void getStoreThreadAndClock(const void *address, thread_id_t * thread, modelclock_t * clock) {
-	uint64_t * shadow = lookupAddressEntry(address);
+void setAtomicStoreFlag(const void *address) {
+	if (wideshadow)
+		cellSetAtomicStoreFlag<WideCell>(address);
+	else
+		cellSetAtomicStoreFlag<NarrowCell>(address);
+}
+
+template <class Cell>
+static void cellGetStoreThreadAndClock(const void *address, thread_id_t * thread, modelclock_t * clock) {
+	uint64_t * shadow = lookupAddressEntry<Cell>(address, false);
 	uint64_t shadowval = *shadow;
 	if (ISSHORTRECORD(shadowval) || shadowval == 0) {
 		//Do we have a non atomic write with a non-zero clock
-		*thread = WRTHREADID(shadowval);
-		*clock = WRITEVECTOR(shadowval);
+		*thread = Cell::writeThread(shadow);
+		*clock = Cell::writeClock(shadow);
 	} else {
 		struct RaceRecord *record = (struct RaceRecord *)shadowval;
 		*thread = record->writeThread;
@@ -116,6 +780,13 @@ void getStoreThreadAndClock(const void *address, thread_id_t * thread, modelcloc
 	}
 }
 
+void getStoreThreadAndClock(const void *address, thread_id_t * thread, modelclock_t * clock) {
+	if (wideshadow)
+		cellGetStoreThreadAndClock<WideCell>(address, thread, clock);
+	else
+		cellGetStoreThreadAndClock<NarrowCell>(address, thread, clock);
+}
+
 /**
  * Compares a current clock-vector/thread-ID pair with a clock/thread-ID pair
  * to check the potential for a data race.
@@ -135,34 +806,32 @@ static bool clock_may_race(ClockVector *clock1, thread_id_t tid1,
  * Expands a record from the compact form to the full form.  This is
  * necessary for multiple readers or for very large thread ids or time
  * stamps. */
+template <class Cell>
 static void expandRecord(uint64_t *shadow)
 {
-	uint64_t shadowval = *shadow;
-
-	modelclock_t readClock = READVECTOR(shadowval);
-	thread_id_t readThread = int_to_id(RDTHREADID(shadowval));
-	modelclock_t writeClock = WRITEVECTOR(shadowval);
-	thread_id_t writeThread = int_to_id(WRTHREADID(shadowval));
+	RACESTAT(expansions);
+	modelclock_t readClock = Cell::readClock(shadow);
+	thread_id_t readThread = int_to_id(Cell::readThread(shadow));
+	modelclock_t writeClock = Cell::writeClock(shadow);
+	thread_id_t writeThread = int_to_id(Cell::writeThread(shadow));
 
 	struct RaceRecord *record = (struct RaceRecord *)snapshot_calloc(1, sizeof(struct RaceRecord));
 	record->writeThread = writeThread;
 	record->writeClock = writeClock;
+	record->capacity = INITCAPACITY;
 
 	if (readClock != 0) {
-		record->thread = (thread_id_t *)snapshot_malloc(sizeof(thread_id_t) * INITCAPACITY);
-		record->readClock = (modelclock_t *)snapshot_malloc(sizeof(modelclock_t) * INITCAPACITY);
 		record->numReads = 1;
 		ASSERT(readThread >= 0);
-		record->thread[0] = readThread;
-		record->readClock[0] = readClock;
-	} else {
-		record->thread = NULL;
+		record->inlineReads[0].thread = readThread;
+		record->inlineReads[0].clock = readClock;
 	}
-	if (shadowval & ATOMICMASK)
+	if (Cell::isAtomic(shadow))
 		record->isAtomic = 1;
-	*shadow = (uint64_t) record;
+	setCellPointer<Cell>(shadow, (uint64_t) record);
 }
 
+
 #define FIRST_STACK_FRAME 2
 
 unsigned int race_hash(struct DataRace *race) {
@@ -188,11 +857,13 @@ bool race_equals(struct DataRace *r1, struct DataRace *r2) {
 static struct DataRace * reportDataRace(thread_id_t oldthread, modelclock_t oldclock, bool isoldwrite, ModelAction *newaction, bool isnewwrite, const void *address)
 {
 #ifdef REPORT_DATA_RACES
+	RACESTAT(races_found);
 	struct DataRace *race = (struct DataRace *)model_malloc(sizeof(struct DataRace));
 	race->oldthread = oldthread;
 	race->oldclock = oldclock;
 	race->isoldwrite = isoldwrite;
-	race->newaction = newaction;
+	race->newthread = newaction->get_tid();
+	race->newseqnum = newaction->get_seq_number();
 	race->isnewwrite = isnewwrite;
 	race->address = address;
 	return race;
@@ -201,42 +872,228 @@ static struct DataRace * reportDataRace(thread_id_t oldthread, modelclock_t oldc
 #endif
 }
 
+/** The first frame of a race's backtrace to print.  Races found by the
+ *  helper thread (-A) only have the access site. */
+static int firstRaceFrame(struct DataRace *race)
+{
+	int first = 0;
+	while (first < race->numframes && race->backtrace[first] == NULL)
+		first++;
+	return first;
+}
+
+/**
+ * @brief Print the races reported in this run and not printed yet
+ *
+ * Races are symbolized together at the end of the run, so that each
+ * distinct frame is looked up once however many races it appears in. A
+ * buggy execution, a failed assertion or a crash prints the races found so
+ * far, since the run may not get to its end.
+ */
+void printRaces()
+{
+#ifdef REPORT_DATA_RACES
+	/* A crash or a failed assertion while printing must not print again */
+	static bool printing = false;
+	if (printing || reportedRaces == NULL)
+		return;
+	RACEQUIESCE();
+	if (reportedRaces->size() == 0)
+		return;
+	printing = true;
+	/* Map each distinct frame to its index in frames, plus one */
+	HashTable<void *, unsigned int, uintptr_t, 4, model_malloc, model_calloc, model_free> frameIndex;
+	ModelVector<void *> frames;
+	for (uint i = 0;i < reportedRaces->size();i++) {
+		struct DataRace *race = (*reportedRaces)[i];
+		for (int j = firstRaceFrame(race);j < race->numframes;j++) {
+			if (!frameIndex.contains(race->backtrace[j])) {
+				frames.push_back(race->backtrace[j]);
+				frameIndex.put(race->backtrace[j], frames.size());
+			}
+		}
+	}
+	char **symbols = backtrace_symbols(&frames[0], frames.size());
+	if (symbols == NULL) {
+		perror("backtrace_symbols");
+		printing = false;
+		return;
+	}
+
+	for (uint i = 0;i < reportedRaces->size();i++) {
+		struct DataRace *race = (*reportedRaces)[i];
+		model_print("Race detected at location: \n");
+		for (int j = firstRaceFrame(race);j < race->numframes;j++)
+			model_print("%s\n", symbols[frameIndex.get(race->backtrace[j]) - 1]);
+		model_print("\nData race detected @ address %p:\n"
+								"    Access 1: %5s in thread %2d @ clock %3u\n"
+								"    Access 2: %5s in thread %2d @ clock %3u\n\n",
+								race->address,
+								race->isoldwrite ? "write" : "read",
+								id_to_int(race->oldthread),
+								race->oldclock,
+								race->isnewwrite ? "write" : "read",
+								id_to_int(race->newthread),
+								race->newseqnum
+								);
+	}
+	free(symbols);
+	reportedRaces->clear();
+	printing = false;
+#endif
+}
+
+/**
+ * Whether location is on the stack of the running thread.  Its accesses by
+ * that thread skip the race check with -P, which misses races on stack
+ * variables that are shared with other threads.
+ */
+bool raceOwnStack(const void *location)
+{
+	return thread_current()->on_stack(location);
+}
+
+static inline unsigned int sampleSiteIndex(const void *pc)
+{
+	uintptr_t key = (uintptr_t)pc;
+	return (key ^ (key >> 12)) & (SAMPLESITES - 1);
+}
+
+/**
+ * Decides whether a sampled access (-R) is race checked.  Every site starts
+ * out checked on each access; each time it has been checked SAMPLEDECAY
+ * times, the period between checks doubles, up to one in 1/RATE.  With
+ * --cold-site-full, the first SAMPLECOLD accesses of a site in each
+ * execution are always checked.
+ * @param pc The return address of the instrumented access
+ */
+bool raceSampleSite(const void *pc)
+{
+	unsigned int index = sampleSiteIndex(pc);
+	struct SampleSite *site = &sampleSites[index];
+	if (site->pc != pc) {
+		/* A new site, or one that evicts another: start over */
+		site->pc = pc;
+		site->period = 1;
+		site->countdown = 0;
+		site->checks = 0;
+		site->raced = false;
+	}
+
+	if (coldSiteFull && sampleColdCounts[index] < SAMPLECOLD) {
+		sampleColdCounts[index]++;
+		return true;
+	}
+	if (site->countdown != 0) {
+		site->countdown--;
+		return false;
+	}
+	site->countdown = site->period - 1;
+	if (!site->raced && site->period < maxSamplePeriod && ++site->checks == SAMPLEDECAY) {
+		site->period = site->period * 2 < maxSamplePeriod ? site->period * 2 : maxSamplePeriod;
+		site->checks = 0;
+	}
+	return true;
+}
+
+/** Goes back to checking every access of the site where a race was found.
+ *  Depending on inlining, the user code is the second or third frame. */
+static void markSampleSiteRaced(struct DataRace *race)
+{
+	for (int i = 1;i <= FIRST_STACK_FRAME && i < race->numframes;i++) {
+		struct SampleSite *site = &sampleSites[sampleSiteIndex(race->backtrace[i])];
+		if (site->pc == race->backtrace[i]) {
+			site->raced = true;
+			site->period = 1;
+			site->countdown = 0;
+		}
+	}
+}
+
 /**
- * @brief Assert a data race
+ * @brief Report a newly detected race, unless it is a duplicate
  *
- * Asserts a data race which is currently realized, causing the execution to
- * end and stashing a message in the model-checker's bug list
+ * Races are deduplicated by backtrace, both within this run and across the
+ * workers of a fork farm.
+ * @param race The race; ownership passes to this function
+ */
+static void addRace(struct DataRace *race)
+{
+#ifdef REPORT_DATA_RACES
+	if (raceSampling)
+		markSampleSiteRaced(race);
+	if (raceset->add(race)) {
+		if (snapshot_farm_add_race(race_hash(race)))
+			reportedRaces->push_back(race);
+	} else {
+		RACESTAT(races_rejected);
+		model_free(race);
+	}
+#else
+	model_free(race);
+#endif
+}
+
+/**
+ * @brief Check whether a race was already found by the same access
  *
- * @param race The race to report
+ * This filters repeats of a race, such as those of a racy loop, before the
+ * stack is unwound.  Two races match if they are at the same address, have
+ * the same access kinds and were found by the same call site; a lost entry
+ * only costs an unwind, as addRace still deduplicates by backtrace.
+ * @param race The race
+ * @param pc The return address of the instrumented access
+ * @return True if a matching race was already found
  */
-void assert_race(struct DataRace *race)
-{
-	model_print("Race detected at location: \n");
-	backtrace_symbols_fd(race->backtrace, race->numframes, model_out);
-	model_print("\nData race detected @ address %p:\n"
-							"    Access 1: %5s in thread %2d @ clock %3u\n"
-							"    Access 2: %5s in thread %2d @ clock %3u\n\n",
-							race->address,
-							race->isoldwrite ? "write" : "read",
-							id_to_int(race->oldthread),
-							race->oldclock,
-							race->isnewwrite ? "write" : "read",
-							id_to_int(race->newaction->get_tid()),
-							race->newaction->get_seq_number()
-							);
+static bool raceFilterSeen(struct DataRace *race, const void *pc)
+{
+	uint64_t key = ((uint64_t)(uintptr_t)race->address << 2) | (race->isoldwrite << 1) | race->isnewwrite;
+	key = (key * 0x9e3779b97f4a7c15ULL) ^ (uintptr_t)pc;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 32;
+	/* Empty entries are zero */
+	key |= 1;
+	uint64_t *entry = &raceFilter[(key >> 1) & (RACEFILTERSIZE - 1)];
+	if (*entry == key) {
+		RACESTAT(races_filtered);
+		return true;
+	}
+	*entry = key;
+	return false;
+}
+
+/** Reports a race found by the access that called this function.
+ *  @param pc The return address of the instrumented access */
+static inline __attribute__((always_inline)) void processRace(struct DataRace *race, const void *pc)
+{
+	if (raceFilterSeen(race, pc)) {
+		model_free(race);
+		return;
+	}
+#ifdef REPORT_DATA_RACES
+	race->numframes=backtrace(race->backtrace, sizeof(race->backtrace)/sizeof(void*));
+#endif
+	addRace(race);
 }
 
 /** This function does race detection for a write on an expanded record. */
 struct DataRace * fullRaceCheckWrite(thread_id_t thread, const void *location, uint64_t *shadow, ClockVector *currClock)
 {
+	RACESTAT(full_checks);
 	struct RaceRecord *record = (struct RaceRecord *)(*shadow);
+	struct RaceRead *reads = recordReads(record);
 	struct DataRace * race = NULL;
+	modelclock_t ourClock = currClock->getClock(thread);
+
+	/* Same epoch: this thread already wrote here since its last action */
+	if (record->numReads == 0 && !record->isAtomic && record->writeThread == thread && record->writeClock == ourClock)
+		return NULL;
 
 	/* Check for datarace against last read. */
 
 	for (int i = 0;i < record->numReads;i++) {
-		modelclock_t readClock = record->readClock[i];
-		thread_id_t readThread = record->thread[i];
+		modelclock_t readClock = reads[i].clock;
+		thread_id_t readThread = reads[i].thread;
 
 		/* Note that readClock can't actuall be zero here, so it could be
 		         optimized. */
@@ -263,84 +1120,75 @@ Exit:
 	record->numReads = 0;
 	record->writeThread = thread;
 	record->isAtomic = 0;
-	modelclock_t ourClock = currClock->getClock(thread);
 	record->writeClock = ourClock;
 	return race;
 }
 
-/** This function does race detection on a write. */
-void raceCheckWrite(thread_id_t thread, void *location)
+/** This function does race detection for a write on one shadow cell. */
+template <class Cell>
+static inline struct DataRace * checkWrite(thread_id_t thread, const void *location, uint64_t *shadow, ClockVector *currClock)
 {
-	uint64_t *shadow = lookupAddressEntry(location);
 	uint64_t shadowval = *shadow;
-	ClockVector *currClock = get_execution()->get_cv(thread);
-	if (currClock == NULL)
-		return;
-
 	struct DataRace * race = NULL;
 	/* Do full record */
-	if (shadowval != 0 && !ISSHORTRECORD(shadowval)) {
-		race = fullRaceCheckWrite(thread, location, shadow, currClock);
-		goto Exit;
-	}
+	if (shadowval != 0 && !ISSHORTRECORD(shadowval))
+		return fullRaceCheckWrite(thread, location, shadow, currClock);
 
-	{
-		int threadid = id_to_int(thread);
-		modelclock_t ourClock = currClock->getClock(thread);
+	int threadid = id_to_int(thread);
+	modelclock_t ourClock = currClock->getClock(thread);
 
-		/* Thread ID is too large or clock is too large. */
-		if (threadid > MAXTHREADID || ourClock > MAXWRITEVECTOR) {
-			expandRecord(shadow);
-			race = fullRaceCheckWrite(thread, location, shadow, currClock);
-			goto Exit;
-		}
+	/* Thread ID is too large or clock is too large. */
+	if (!Cell::fits(threadid, ourClock)) {
+		expandRecord<Cell>(shadow);
+		return fullRaceCheckWrite(thread, location, shadow, currClock);
+	}
+	RACESTAT(compact_checks);
 
-		{
-			/* Check for datarace against last read. */
-			modelclock_t readClock = READVECTOR(shadowval);
-			thread_id_t readThread = int_to_id(RDTHREADID(shadowval));
+	/* Same epoch: this thread already wrote here since its last action */
+	if (Cell::isWrite(shadow, threadid, ourClock, false))
+		return NULL;
 
-			if (clock_may_race(currClock, thread, readClock, readThread)) {
-				/* We have a datarace */
-				race = reportDataRace(readThread, readClock, false, get_execution()->get_parent_action(thread), true, location);
-				goto ShadowExit;
-			}
-		}
+	{
+		/* Check for datarace against last read. */
+		modelclock_t readClock = Cell::readClock(shadow);
+		thread_id_t readThread = int_to_id(Cell::readThread(shadow));
 
-		{
-			/* Check for datarace against last write. */
-			modelclock_t writeClock = WRITEVECTOR(shadowval);
-			thread_id_t writeThread = int_to_id(WRTHREADID(shadowval));
-
-			if (clock_may_race(currClock, thread, writeClock, writeThread)) {
-				/* We have a datarace */
-				race = reportDataRace(writeThread, writeClock, true, get_execution()->get_parent_action(thread), true, location);
-				goto ShadowExit;
-			}
+		if (clock_may_race(currClock, thread, readClock, readThread)) {
+			/* We have a datarace */
+			race = reportDataRace(readThread, readClock, false, get_execution()->get_parent_action(thread), true, location);
+			goto ShadowExit;
 		}
-
-ShadowExit:
-		*shadow = ENCODEOP(0, 0, threadid, ourClock);
 	}
 
-Exit:
-	if (race) {
-#ifdef REPORT_DATA_RACES
-		race->numframes=backtrace(race->backtrace, sizeof(race->backtrace)/sizeof(void*));
-		if (raceset->add(race))
-			assert_race(race);
-		else model_free(race);
-#else
-		model_free(race);
-#endif
+	{
+		/* Check for datarace against last write. */
+		modelclock_t writeClock = Cell::writeClock(shadow);
+		thread_id_t writeThread = int_to_id(Cell::writeThread(shadow));
+
+		if (clock_may_race(currClock, thread, writeClock, writeThread)) {
+			/* We have a datarace */
+			race = reportDataRace(writeThread, writeClock, true, get_execution()->get_parent_action(thread), true, location);
+			goto ShadowExit;
+		}
 	}
+
+ShadowExit:
+	Cell::encode(shadow, 0, 0, threadid, ourClock, false);
+	return race;
 }
 
 /** This function does race detection for a write on an expanded record. */
 struct DataRace * atomfullRaceCheckWrite(thread_id_t thread, const void *location, uint64_t *shadow, ClockVector *currClock)
 {
+	RACESTAT(full_checks);
 	struct RaceRecord *record = (struct RaceRecord *)(*shadow);
+	struct RaceRead *reads = recordReads(record);
 	struct DataRace * race = NULL;
+	modelclock_t ourClock = currClock->getClock(thread);
+
+	/* Same epoch: this thread already wrote here since its last action */
+	if (record->numReads == 0 && record->isAtomic && record->writeThread == thread && record->writeClock == ourClock)
+		return NULL;
 
 	if (record->isAtomic)
 		goto Exit;
@@ -348,8 +1196,8 @@ struct DataRace * atomfullRaceCheckWrite(thread_id_t thread, const void *locatio
 	/* Check for datarace against last read. */
 
 	for (int i = 0;i < record->numReads;i++) {
-		modelclock_t readClock = record->readClock[i];
-		thread_id_t readThread = record->thread[i];
+		modelclock_t readClock = reads[i].clock;
+		thread_id_t readThread = reads[i].thread;
 
 		/* Note that readClock can't actuall be zero here, so it could be
 		         optimized. */
@@ -377,85 +1225,69 @@ Exit:
 	record->numReads = 0;
 	record->writeThread = thread;
 	record->isAtomic = 1;
-	modelclock_t ourClock = currClock->getClock(thread);
 	record->writeClock = ourClock;
 	return race;
 }
 
-/** This function does race detection on a write. */
-void atomraceCheckWrite(thread_id_t thread, void *location)
+/** This function does race detection for an atomic write on one shadow cell. */
+template <class Cell>
+static inline struct DataRace * checkAtomicWrite(thread_id_t thread, const void *location, uint64_t *shadow, ClockVector *currClock)
 {
-	uint64_t *shadow = lookupAddressEntry(location);
 	uint64_t shadowval = *shadow;
-	ClockVector *currClock = get_execution()->get_cv(thread);
-	if (currClock == NULL)
-		return;
-
 	struct DataRace * race = NULL;
 	/* Do full record */
-	if (shadowval != 0 && !ISSHORTRECORD(shadowval)) {
-		race = atomfullRaceCheckWrite(thread, location, shadow, currClock);
-		goto Exit;
-	}
+	if (shadowval != 0 && !ISSHORTRECORD(shadowval))
+		return atomfullRaceCheckWrite(thread, location, shadow, currClock);
 
-	{
-		int threadid = id_to_int(thread);
-		modelclock_t ourClock = currClock->getClock(thread);
+	int threadid = id_to_int(thread);
+	modelclock_t ourClock = currClock->getClock(thread);
 
-		/* Thread ID is too large or clock is too large. */
-		if (threadid > MAXTHREADID || ourClock > MAXWRITEVECTOR) {
-			expandRecord(shadow);
-			race = atomfullRaceCheckWrite(thread, location, shadow, currClock);
-			goto Exit;
-		}
+	/* Thread ID is too large or clock is too large. */
+	if (!Cell::fits(threadid, ourClock)) {
+		expandRecord<Cell>(shadow);
+		return atomfullRaceCheckWrite(thread, location, shadow, currClock);
+	}
+	RACESTAT(compact_checks);
 
-		/* Can't race with atomic */
-		if (shadowval & ATOMICMASK)
-			goto ShadowExit;
+	/* Same epoch: this thread already wrote here since its last action */
+	if (Cell::isWrite(shadow, threadid, ourClock, true))
+		return NULL;
 
-		{
-			/* Check for datarace against last read. */
-			modelclock_t readClock = READVECTOR(shadowval);
-			thread_id_t readThread = int_to_id(RDTHREADID(shadowval));
+	/* Can't race with atomic */
+	if (Cell::isAtomic(shadow))
+		goto ShadowExit;
 
-			if (clock_may_race(currClock, thread, readClock, readThread)) {
-				/* We have a datarace */
-				race = reportDataRace(readThread, readClock, false, get_execution()->get_parent_action(thread), true, location);
-				goto ShadowExit;
-			}
+	{
+		/* Check for datarace against last read. */
+		modelclock_t readClock = Cell::readClock(shadow);
+		thread_id_t readThread = int_to_id(Cell::readThread(shadow));
+
+		if (clock_may_race(currClock, thread, readClock, readThread)) {
+			/* We have a datarace */
+			race = reportDataRace(readThread, readClock, false, get_execution()->get_parent_action(thread), true, location);
+			goto ShadowExit;
 		}
+	}
 
-		{
-			/* Check for datarace against last write. */
-			modelclock_t writeClock = WRITEVECTOR(shadowval);
-			thread_id_t writeThread = int_to_id(WRTHREADID(shadowval));
+	{
+		/* Check for datarace against last write. */
+		modelclock_t writeClock = Cell::writeClock(shadow);
+		thread_id_t writeThread = int_to_id(Cell::writeThread(shadow));
 
-			if (clock_may_race(currClock, thread, writeClock, writeThread)) {
-				/* We have a datarace */
-				race = reportDataRace(writeThread, writeClock, true, get_execution()->get_parent_action(thread), true, location);
-				goto ShadowExit;
-			}
+		if (clock_may_race(currClock, thread, writeClock, writeThread)) {
+			/* We have a datarace */
+			race = reportDataRace(writeThread, writeClock, true, get_execution()->get_parent_action(thread), true, location);
+			goto ShadowExit;
 		}
-
-ShadowExit:
-		*shadow = ENCODEOP(0, 0, threadid, ourClock) | ATOMICMASK;
 	}
 
-Exit:
-	if (race) {
-#ifdef REPORT_DATA_RACES
-		race->numframes=backtrace(race->backtrace, sizeof(race->backtrace)/sizeof(void*));
-		if (raceset->add(race))
-			assert_race(race);
-		else model_free(race);
-#else
-		model_free(race);
-#endif
-	}
+ShadowExit:
+	Cell::encode(shadow, 0, 0, threadid, ourClock, true);
+	return race;
 }
 
 /** This function does race detection for a write on an expanded record. */
-void fullRecordWrite(thread_id_t thread, void *location, uint64_t *shadow, ClockVector *currClock) {
+void fullRecordWrite(thread_id_t thread, const void *location, uint64_t *shadow, ClockVector *currClock) {
 	struct RaceRecord *record = (struct RaceRecord *)(*shadow);
 	record->numReads = 0;
 	record->writeThread = thread;
@@ -465,7 +1297,7 @@ void fullRecordWrite(thread_id_t thread, void *location, uint64_t *shadow, Clock
 }
 
 /** This function does race detection for a write on an expanded record. */
-void fullRecordWriteNonAtomic(thread_id_t thread, void *location, uint64_t *shadow, ClockVector *currClock) {
+void fullRecordWriteNonAtomic(thread_id_t thread, const void *location, uint64_t *shadow, ClockVector *currClock) {
 	struct RaceRecord *record = (struct RaceRecord *)(*shadow);
 	record->numReads = 0;
 	record->writeThread = thread;
@@ -474,11 +1306,11 @@ void fullRecordWriteNonAtomic(thread_id_t thread, void *location, uint64_t *shad
 	record->isAtomic = 0;
 }
 
-/** This function just updates metadata on atomic write. */
-void recordWrite(thread_id_t thread, void *location) {
-	uint64_t *shadow = lookupAddressEntry(location);
+/** This function just updates metadata on an atomic write to one shadow cell. */
+template <class Cell>
+static inline void recordWriteWord(thread_id_t thread, const void *location, uint64_t *shadow, ClockVector *currClock)
+{
 	uint64_t shadowval = *shadow;
-	ClockVector *currClock = get_execution()->get_cv(thread);
 	/* Do full record */
 	if (shadowval != 0 && !ISSHORTRECORD(shadowval)) {
 		fullRecordWrite(thread, location, shadow, currClock);
@@ -489,48 +1321,61 @@ void recordWrite(thread_id_t thread, void *location) {
 	modelclock_t ourClock = currClock->getClock(thread);
 
 	/* Thread ID is too large or clock is too large. */
-	if (threadid > MAXTHREADID || ourClock > MAXWRITEVECTOR) {
-		expandRecord(shadow);
+	if (!Cell::fits(threadid, ourClock)) {
+		expandRecord<Cell>(shadow);
 		fullRecordWrite(thread, location, shadow, currClock);
 		return;
 	}
 
-	*shadow = ENCODEOP(0, 0, threadid, ourClock) | ATOMICMASK;
+	Cell::encode(shadow, 0, 0, threadid, ourClock, true);
 }
 
-/** This function just updates metadata on atomic write. */
-void recordCalloc(void *location, size_t size) {
-	thread_id_t thread = thread_current_id();
-	for(;size != 0;size--) {
-		uint64_t *shadow = lookupAddressEntry(location);
-		uint64_t shadowval = *shadow;
-		ClockVector *currClock = get_execution()->get_cv(thread);
-		/* Do full record */
-		if (shadowval != 0 && !ISSHORTRECORD(shadowval)) {
-			fullRecordWriteNonAtomic(thread, location, shadow, currClock);
-			return;
-		}
-
-		int threadid = id_to_int(thread);
-		modelclock_t ourClock = currClock->getClock(thread);
+/** This function just updates metadata on a calloc to one shadow cell. */
+template <class Cell>
+static inline void recordCallocWord(thread_id_t thread, const void *location, uint64_t *shadow, ClockVector *currClock)
+{
+	uint64_t shadowval = *shadow;
+	/* Do full record */
+	if (shadowval != 0 && !ISSHORTRECORD(shadowval)) {
+		fullRecordWriteNonAtomic(thread, location, shadow, currClock);
+		return;
+	}
 
-		/* Thread ID is too large or clock is too large. */
-		if (threadid > MAXTHREADID || ourClock > MAXWRITEVECTOR) {
-			expandRecord(shadow);
-			fullRecordWriteNonAtomic(thread, location, shadow, currClock);
-			return;
-		}
+	int threadid = id_to_int(thread);
+	modelclock_t ourClock = currClock->getClock(thread);
 
-		*shadow = ENCODEOP(0, 0, threadid, ourClock);
-		location = (void *)(((char *) location) + 1);
+	/* Thread ID is too large or clock is too large. */
+	if (!Cell::fits(threadid, ourClock)) {
+		expandRecord<Cell>(shadow);
+		fullRecordWriteNonAtomic(thread, location, shadow, currClock);
+		return;
 	}
+
+	Cell::encode(shadow, 0, 0, threadid, ourClock, false);
 }
 
 /** This function does race detection on a read for an expanded record. */
 struct DataRace * fullRaceCheckRead(thread_id_t thread, const void *location, uint64_t *shadow, ClockVector *currClock)
 {
+	RACESTAT(full_checks);
 	struct RaceRecord *record = (struct RaceRecord *) (*shadow);
+	struct RaceRead *reads = recordReads(record);
 	struct DataRace * race = NULL;
+	modelclock_t ourClock = currClock->getClock(thread);
+
+	/* Find this thread's own read, which this read subsumes */
+	int ownindex = -1;
+	for (int i = 0;i < record->numReads;i++) {
+		if (reads[i].thread == thread) {
+			/* Same epoch: nothing has changed since that read, as a write
+			   would have cleared it */
+			if (reads[i].clock == ourClock)
+				return NULL;
+			ownindex = i;
+			break;
+		}
+	}
+
 	/* Check for datarace against last write. */
 
 	modelclock_t writeClock = record->writeClock;
@@ -541,13 +1386,20 @@ struct DataRace * fullRaceCheckRead(thread_id_t thread, const void *location, ui
 		race = reportDataRace(writeThread, writeClock, true, get_execution()->get_parent_action(thread), false, location);
 	}
 
+	/* Update our own entry in place instead of rebuilding the vector; reads
+	   it fails to drop are only checked again by the next write */
+	if (ownindex >= 0) {
+		reads[ownindex].clock = ourClock;
+		return race;
+	}
+
 	/* Shorten vector when possible */
 
 	int copytoindex = 0;
 
 	for (int i = 0;i < record->numReads;i++) {
-		modelclock_t readClock = record->readClock[i];
-		thread_id_t readThread = record->thread[i];
+		modelclock_t readClock = reads[i].clock;
+		thread_id_t readThread = reads[i].thread;
 
 		/*  Note that is not really a datarace check as reads cannot
 		                actually race.  It is just determining that this read subsumes
@@ -559,111 +1411,87 @@ struct DataRace * fullRaceCheckRead(thread_id_t thread, const void *location, ui
 			/* Still need this read in vector */
 			if (copytoindex != i) {
 				ASSERT(readThread >= 0);
-				record->readClock[copytoindex] = readClock;
-				record->thread[copytoindex] = readThread;
+				reads[copytoindex] = reads[i];
 			}
 			copytoindex++;
 		}
 	}
 
-	if (__builtin_popcount(copytoindex) <= 1) {
-		if (copytoindex == 0 && record->thread == NULL) {
-			int newCapacity = INITCAPACITY;
-			record->thread = (thread_id_t *)snapshot_malloc(sizeof(thread_id_t) * newCapacity);
-			record->readClock = (modelclock_t *)snapshot_malloc(sizeof(modelclock_t) * newCapacity);
-		} else if (copytoindex>=INITCAPACITY) {
-			int newCapacity = copytoindex * 2;
-			thread_id_t *newthread = (thread_id_t *)snapshot_malloc(sizeof(thread_id_t) * newCapacity);
-			modelclock_t *newreadClock = (modelclock_t *)snapshot_malloc(sizeof(modelclock_t) * newCapacity);
-			std::memcpy(newthread, record->thread, copytoindex * sizeof(thread_id_t));
-			std::memcpy(newreadClock, record->readClock, copytoindex * sizeof(modelclock_t));
-			snapshot_free(record->readClock);
-			snapshot_free(record->thread);
-			record->readClock = newreadClock;
-			record->thread = newthread;
-		}
+	if (copytoindex == record->capacity) {
+		RACESTAT(read_growths);
+		int newCapacity = record->capacity * 2;
+		struct RaceRead *newreads = allocReads(newCapacity);
+		std::memcpy(newreads, reads, copytoindex * sizeof(struct RaceRead));
+		if (record->capacity > INITCAPACITY)
+			freeReads(reads, record->capacity);
+		record->pooledReads = newreads;
+		record->capacity = newCapacity;
+		reads = newreads;
 	}
 
-	modelclock_t ourClock = currClock->getClock(thread);
-
 	ASSERT(thread >= 0);
-	record->thread[copytoindex] = thread;
-	record->readClock[copytoindex] = ourClock;
+	reads[copytoindex].thread = thread;
+	reads[copytoindex].clock = ourClock;
 	record->numReads = copytoindex + 1;
 	return race;
 }
 
-/** This function does race detection on a read. */
-void raceCheckRead(thread_id_t thread, const void *location)
+/** This function does race detection for a read on one shadow cell. */
+template <class Cell>
+static inline struct DataRace * checkRead(thread_id_t thread, const void *location, uint64_t *shadow, ClockVector *currClock)
 {
-	uint64_t *shadow = lookupAddressEntry(location);
 	uint64_t shadowval = *shadow;
-	ClockVector *currClock = get_execution()->get_cv(thread);
-	if (currClock == NULL)
-		return;
-
 	struct DataRace * race = NULL;
 
 	/* Do full record */
-	if (shadowval != 0 && !ISSHORTRECORD(shadowval)) {
-		race = fullRaceCheckRead(thread, location, shadow, currClock);
-		goto Exit;
+	if (shadowval != 0 && !ISSHORTRECORD(shadowval))
+		return fullRaceCheckRead(thread, location, shadow, currClock);
+
+	int threadid = id_to_int(thread);
+	modelclock_t ourClock = currClock->getClock(thread);
+
+	/* Thread ID is too large or clock is too large. */
+	if (!Cell::fits(threadid, ourClock)) {
+		expandRecord<Cell>(shadow);
+		return fullRaceCheckRead(thread, location, shadow, currClock);
 	}
+	RACESTAT(compact_checks);
 
-	{
-		int threadid = id_to_int(thread);
-		modelclock_t ourClock = currClock->getClock(thread);
+	/* Same epoch: this thread already read here since its last action, and
+	   any write since would have cleared the read */
+	if (Cell::readClock(shadow) == ourClock && Cell::readThread(shadow) == threadid)
+		return NULL;
 
-		/* Thread ID is too large or clock is too large. */
-		if (threadid > MAXTHREADID || ourClock > MAXWRITEVECTOR) {
-			expandRecord(shadow);
-			race = fullRaceCheckRead(thread, location, shadow, currClock);
-			goto Exit;
-		}
+	/* Check for datarace against last write. */
 
-		/* Check for datarace against last write. */
+	modelclock_t writeClock = Cell::writeClock(shadow);
+	thread_id_t writeThread = int_to_id(Cell::writeThread(shadow));
 
-		modelclock_t writeClock = WRITEVECTOR(shadowval);
-		thread_id_t writeThread = int_to_id(WRTHREADID(shadowval));
+	if (clock_may_race(currClock, thread, writeClock, writeThread)) {
+		/* We have a datarace */
+		race = reportDataRace(writeThread, writeClock, true, get_execution()->get_parent_action(thread), false, location);
+	}
 
-		if (clock_may_race(currClock, thread, writeClock, writeThread)) {
-			/* We have a datarace */
-			race = reportDataRace(writeThread, writeClock, true, get_execution()->get_parent_action(thread), false, location);
-			goto ShadowExit;
-		}
+	{
+		modelclock_t readClock = Cell::readClock(shadow);
+		thread_id_t readThread = int_to_id(Cell::readThread(shadow));
 
-ShadowExit:
-		{
-			modelclock_t readClock = READVECTOR(shadowval);
-			thread_id_t readThread = int_to_id(RDTHREADID(shadowval));
-
-			if (clock_may_race(currClock, thread, readClock, readThread)) {
-				/* We don't subsume this read... Have to expand record. */
-				expandRecord(shadow);
-				fullRaceCheckRead(thread, location, shadow, currClock);
-				goto Exit;
-			}
+		if (clock_may_race(currClock, thread, readClock, readThread)) {
+			/* We don't subsume this read... Have to expand record. */
+			expandRecord<Cell>(shadow);
+			fullRaceCheckRead(thread, location, shadow, currClock);
+			return race;
 		}
-
-		*shadow = ENCODEOP(threadid, ourClock, id_to_int(writeThread), writeClock) | (shadowval & ATOMICMASK);
-	}
-Exit:
-	if (race) {
-#ifdef REPORT_DATA_RACES
-		race->numframes=backtrace(race->backtrace, sizeof(race->backtrace)/sizeof(void*));
-		if (raceset->add(race))
-			assert_race(race);
-		else model_free(race);
-#else
-		model_free(race);
-#endif
 	}
-}
 
+	Cell::encode(shadow, threadid, ourClock, id_to_int(writeThread), writeClock, Cell::isAtomic(shadow));
+	return race;
+}
 
 /** This function does race detection on a read for an expanded record. */
 struct DataRace * atomfullRaceCheckRead(thread_id_t thread, const void *location, uint64_t *shadow, ClockVector *currClock)
 {
+	RACESTAT(full_checks);
 	struct RaceRecord *record = (struct RaceRecord *) (*shadow);
 	struct DataRace * race = NULL;
 	/* Check for datarace against last write. */
@@ -680,538 +1508,500 @@ struct DataRace * atomfullRaceCheckRead(thread_id_t thread, const void *location
 	return race;
 }
 
-/** This function does race detection on a read. */
-void atomraceCheckRead(thread_id_t thread, const void *location)
+/** This function does race detection for an atomic read on one shadow cell. */
+template <class Cell>
+static inline struct DataRace * checkAtomicRead(thread_id_t thread, const void *location, uint64_t *shadow, ClockVector *currClock)
 {
-	uint64_t *shadow = lookupAddressEntry(location);
 	uint64_t shadowval = *shadow;
-	ClockVector *currClock = get_execution()->get_cv(thread);
-	if (currClock == NULL)
-		return;
-
-	struct DataRace * race = NULL;
 
 	/* Do full record */
-	if (shadowval != 0 && !ISSHORTRECORD(shadowval)) {
-		race = atomfullRaceCheckRead(thread, location, shadow, currClock);
-		goto Exit;
-	}
+	if (shadowval != 0 && !ISSHORTRECORD(shadowval))
+		return atomfullRaceCheckRead(thread, location, shadow, currClock);
 
-	if (shadowval & ATOMICMASK)
-		return;
-
-	{
-		/* Check for datarace against last write. */
-		modelclock_t writeClock = WRITEVECTOR(shadowval);
-		thread_id_t writeThread = int_to_id(WRTHREADID(shadowval));
-
-		if (clock_may_race(currClock, thread, writeClock, writeThread)) {
-			/* We have a datarace */
-			race = reportDataRace(writeThread, writeClock, true, get_execution()->get_parent_action(thread), false, location);
-			goto Exit;
-		}
+	RACESTAT(compact_checks);
+	if (Cell::isAtomic(shadow))
+		return NULL;
 
+	/* Check for datarace against last write. */
+	modelclock_t writeClock = Cell::writeClock(shadow);
+	thread_id_t writeThread = int_to_id(Cell::writeThread(shadow));
 
+	if (clock_may_race(currClock, thread, writeClock, writeThread)) {
+		/* We have a datarace */
+		return reportDataRace(writeThread, writeClock, true, get_execution()->get_parent_action(thread), false, location);
 	}
-Exit:
-	if (race) {
-#ifdef REPORT_DATA_RACES
-		race->numframes=backtrace(race->backtrace, sizeof(race->backtrace)/sizeof(void*));
-		if (raceset->add(race))
-			assert_race(race);
-		else model_free(race);
-#else
-		model_free(race);
-#endif
-	}
+	return NULL;
 }
 
-static inline uint64_t * raceCheckRead_firstIt(thread_id_t thread, const void * location, uint64_t *old_val, uint64_t *new_val)
+/** The kinds of access that update the shadow memory */
+enum shadow_access {
+	ACCESS_WRITE,	/**< Non-atomic write */
+	ACCESS_READ,	/**< Non-atomic read */
+	ACCESS_ATOMIC_WRITE,	/**< Atomic write */
+	ACCESS_ATOMIC_READ,	/**< Atomic read */
+	ACCESS_RECORD_WRITE,	/**< Atomic write that only updates metadata */
+	ACCESS_CALLOC	/**< Zeroing allocation that only updates metadata */
+};
+
+/** Applies an access to one shadow cell. */
+template <class Cell>
+static inline struct DataRace * accessWord(enum shadow_access kind, thread_id_t thread, const void *location, uint64_t *shadow, ClockVector *currClock)
 {
-	uint64_t *shadow = lookupAddressEntry(location);
-	uint64_t shadowval = *shadow;
-
-	ClockVector *currClock = get_execution()->get_cv(thread);
-	if (currClock == NULL)
-		return shadow;
-
-	struct DataRace * race = NULL;
-
-	/* Do full record */
-	if (shadowval != 0 && !ISSHORTRECORD(shadowval)) {
-		race = fullRaceCheckRead(thread, location, shadow, currClock);
-		goto Exit;
+	switch (kind) {
+	case ACCESS_WRITE:
+		return checkWrite<Cell>(thread, location, shadow, currClock);
+	case ACCESS_READ:
+		return checkRead<Cell>(thread, location, shadow, currClock);
+	case ACCESS_ATOMIC_WRITE:
+		return checkAtomicWrite<Cell>(thread, location, shadow, currClock);
+	case ACCESS_ATOMIC_READ:
+		return checkAtomicRead<Cell>(thread, location, shadow, currClock);
+	case ACCESS_RECORD_WRITE:
+		recordWriteWord<Cell>(thread, location, shadow, currClock);
+		return NULL;
+	case ACCESS_CALLOC:
+		recordCallocWord<Cell>(thread, location, shadow, currClock);
+		return NULL;
 	}
+	return NULL;
+}
 
-	{
-		int threadid = id_to_int(thread);
-		modelclock_t ourClock = currClock->getClock(thread);
-
-		/* Thread ID is too large or clock is too large. */
-		if (threadid > MAXTHREADID || ourClock > MAXWRITEVECTOR) {
-			expandRecord(shadow);
-			race = fullRaceCheckRead(thread, location, shadow, currClock);
-			goto Exit;
-		}
-
-		/* Check for datarace against last write. */
-		modelclock_t writeClock = WRITEVECTOR(shadowval);
-		thread_id_t writeThread = int_to_id(WRTHREADID(shadowval));
+/** Keeps the first race found by an access and drops the rest; processRace
+ *  would deduplicate them by backtrace anyway. */
+static inline struct DataRace * firstRace(struct DataRace *race, struct DataRace *other)
+{
+	if (race == NULL)
+		return other;
+	if (other != NULL)
+		model_free(other);
+	return race;
+}
 
-		if (clock_may_race(currClock, thread, writeClock, writeThread)) {
-			/* We have a datarace */
-			race = reportDataRace(writeThread, writeClock, true, get_execution()->get_parent_action(thread), false, location);
-		}
+/**
+ * Applies an access to the bytes [location, location + size) of a single
+ * granule.  An access that covers the whole granule of an unsplit granule
+ * costs one check; any other access splits the granule into per-byte
+ * cells.  Neighbouring bytes that share the same compact record share the
+ * result of the first byte's check.
+ */
+template <class Cell>
+static struct DataRace * accessGranuleAt(enum shadow_access kind, thread_id_t thread, const void *location, uint64_t *granule, unsigned int size, ClockVector *currClock)
+{
+	uint64_t *bytes;
+	if (ISSPLITGRANULE(granule[0])) {
+		bytes = GRANULEBYTES(granule[0]);
+	} else {
+		if (size == GRANULESIZE)
+			return accessWord<Cell>(kind, thread, location, granule, currClock);
+		bytes = splitGranule<Cell>(granule);
+	}
 
-		modelclock_t readClock = READVECTOR(shadowval);
-		thread_id_t readThread = int_to_id(RDTHREADID(shadowval));
+	uint64_t *shadow = &bytes[(((uintptr_t)location) & GRANULEMASK) * Cell::WORDS];
+	uint64_t oldcell[Cell::WORDS];
+	copyCell<Cell>(oldcell, shadow);
+	struct DataRace *race = accessWord<Cell>(kind, thread, location, shadow, currClock);
+	bool compact = shadow[0] == 0 || ISSHORTRECORD(shadow[0]);
+	for (unsigned int i = 1;i < size;i++) {
+		uint64_t *cell = &shadow[i * Cell::WORDS];
+		if (compact && cellEquals<Cell>(cell, oldcell))
+			copyCell<Cell>(cell, shadow);
+		else
+			race = firstRace(race, accessWord<Cell>(kind, thread, ((const char *)location) + i, cell, currClock));
+	}
 
-		if (clock_may_race(currClock, thread, readClock, readThread)) {
-			/* We don't subsume this read... Have to expand record. */
-			expandRecord(shadow);
-			struct RaceRecord *record = (struct RaceRecord *) (*shadow);
-			record->thread[1] = thread;
-			record->readClock[1] = ourClock;
-			record->numReads++;
+	/* A whole-granule access typically leaves all bytes alike again */
+	if (size == GRANULESIZE)
+		collapseGranule<Cell>(granule);
+	return race;
+}
 
-			goto Exit;
-		}
+template <class Cell>
+static inline struct DataRace * accessGranule(enum shadow_access kind, thread_id_t thread, const void *location, unsigned int size, ClockVector *currClock)
+{
+	return accessGranuleAt<Cell>(kind, thread, location, lookupGranuleEntry<Cell>(location), size, currClock);
+}
 
-		*shadow = ENCODEOP(threadid, ourClock, id_to_int(writeThread), writeClock) | (shadowval & ATOMICMASK);
+/**
+ * Applies a whole-granule access to count consecutive granules of one base
+ * table.  A run of granules holding the same compact record as the one
+ * just checked cannot produce a new race, so it takes the same result
+ * without another check.
+ */
+template <class Cell>
+static struct DataRace * accessGranuleRun(enum shadow_access kind, thread_id_t thread, const char *location, uint64_t *granules, size_t count, ClockVector *currClock)
+{
+	struct DataRace *race = NULL;
+	size_t i = 0;
+	while (i < count) {
+		uint64_t *granule = &granules[i * Cell::WORDS];
+		uint64_t oldcell[Cell::WORDS];
+		copyCell<Cell>(oldcell, granule);
+		race = firstRace(race, accessGranuleAt<Cell>(kind, thread, location + (i << GRANULESHIFT), granule, GRANULESIZE, currClock));
+		i++;
+		if (oldcell[0] != 0 && !ISSHORTRECORD(oldcell[0]))
+			continue;
+		if (granule[0] != 0 && !ISSHORTRECORD(granule[0]))
+			continue;
+		size_t run = Cell::match(&granules[i * Cell::WORDS], count - i, oldcell);
+		for (size_t j = 0;j < run;j++)
+			copyCell<Cell>(&granules[(i + j) * Cell::WORDS], granule);
+		i += run;
+	}
+	return race;
+}
 
-		*old_val = shadowval;
-		*new_val = *shadow;
+/** Applies an access to [location, location + size), walking the shadow
+ *  one base table at a time. */
+template <class Cell>
+static struct DataRace * accessCellRange(enum shadow_access kind, thread_id_t thread, const void *location, size_t size, ClockVector *currClock)
+{
+	const char *curr = (const char *)location;
+	const char *end = curr + size;
+	struct DataRace *race = NULL;
+	unsigned int offset = ((uintptr_t)curr) & GRANULEMASK;
+	if (offset != 0 && curr < end) {
+		size_t len = GRANULESIZE - offset;
+		if (len > (size_t)(end - curr))
+			len = end - curr;
+		race = accessGranule<Cell>(kind, thread, curr, len, currClock);
+		curr += len;
 	}
-Exit:
-	if (race) {
-#ifdef REPORT_DATA_RACES
-		race->numframes=backtrace(race->backtrace, sizeof(race->backtrace)/sizeof(void*));
-		if (raceset->add(race))
-			assert_race(race);
-		else model_free(race);
-#else
-		model_free(race);
-#endif
+	while ((size_t)(end - curr) >= GRANULESIZE) {
+		size_t count = (end - curr) >> GRANULESHIFT;
+		size_t intable = (MASK16BIT + 1 - (((uintptr_t)curr) & MASK16BIT)) >> GRANULESHIFT;
+		if (count > intable)
+			count = intable;
+		race = firstRace(race, accessGranuleRun<Cell>(kind, thread, curr, lookupGranuleEntry<Cell>(curr), count, currClock));
+		curr += count << GRANULESHIFT;
 	}
-
-	return shadow;
+	if (curr < end)
+		race = firstRace(race, accessGranule<Cell>(kind, thread, curr, end - curr, currClock));
+	return race;
 }
 
-static inline void raceCheckRead_otherIt(thread_id_t thread, const void * location) {
-	uint64_t *shadow = lookupAddressEntry(location);
+/** Applies an access of up to 8 bytes, which may straddle two granules. */
+template <class Cell>
+static inline struct DataRace * accessCells(enum shadow_access kind, thread_id_t thread, const void *location, unsigned int size, ClockVector *currClock)
+{
+	unsigned int offset = ((uintptr_t)location) & GRANULEMASK;
+	if (offset + size <= GRANULESIZE)
+		return accessGranule<Cell>(kind, thread, location, size, currClock);
 
-	uint64_t shadowval = *shadow;
+	unsigned int first = GRANULESIZE - offset;
+	struct DataRace *race = accessGranule<Cell>(kind, thread, location, first, currClock);
+	return firstRace(race, accessGranule<Cell>(kind, thread, ((const char *)location) + first, size - first, currClock));
+}
 
+/** Applies an access to [location, location + size) in the shadow layout
+ *  chosen at startup. */
+static struct DataRace * accessRange(enum shadow_access kind, thread_id_t thread, const void *location, size_t size)
+{
 	ClockVector *currClock = get_execution()->get_cv(thread);
 	if (currClock == NULL)
-		return;
-
-	struct DataRace * race = NULL;
+		return NULL;
+	if (wideshadow)
+		return accessCellRange<WideCell>(kind, thread, location, size, currClock);
+	return accessCellRange<NarrowCell>(kind, thread, location, size, currClock);
+}
 
-	/* Do full record */
-	if (shadowval != 0 && !ISSHORTRECORD(shadowval)) {
-		race = fullRaceCheckRead(thread, location, shadow, currClock);
-		goto Exit;
-	}
+/** Applies an access of up to 8 bytes in the shadow layout chosen at
+ *  startup. */
+static inline struct DataRace * accessShadow(enum shadow_access kind, thread_id_t thread, const void *location, unsigned int size)
+{
+	ClockVector *currClock = get_execution()->get_cv(thread);
+	if (currClock == NULL)
+		return NULL;
+	if (wideshadow)
+		return accessCells<WideCell>(kind, thread, location, size, currClock);
+	return accessCells<NarrowCell>(kind, thread, location, size, currClock);
+}
 
-	{
-		int threadid = id_to_int(thread);
-		modelclock_t ourClock = currClock->getClock(thread);
+/** Spins while waiting on the other side of the queue, giving up the core
+ *  now and then in case both share one. */
+static inline void asyncPause(unsigned int *spins)
+{
+	if (++(*spins) % ASYNCSPIN == 0)
+		syscall(SYS_sched_yield);
+#ifdef __SSE2__
+	_mm_pause();
+#endif
+}
 
-		/* Thread ID is too large or clock is too large. */
-		if (threadid > MAXTHREADID || ourClock > MAXWRITEVECTOR) {
-			expandRecord(shadow);
-			race = fullRaceCheckRead(thread, location, shadow, currClock);
-			goto Exit;
-		}
+/** Wakes the helper thread if it went to sleep, possibly before seeing the
+ *  latest queued access. */
+static inline void kickRaceHelper()
+{
+	if (__atomic_load_n(&asyncSleeping, __ATOMIC_RELAXED))
+		syscall(SYS_futex, &asyncHead, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
 
-		/* Check for datarace against last write. */
-		modelclock_t writeClock = WRITEVECTOR(shadowval);
-		thread_id_t writeThread = int_to_id(WRTHREADID(shadowval));
+/** Waits for an access past tail to be queued, spinning for a while before
+ *  sleeping. */
+static void waitForAccesses(unsigned int tail)
+{
+	for (unsigned int spins = 0;spins < ASYNCSPIN;) {
+		if (__atomic_load_n(&asyncHead, __ATOMIC_ACQUIRE) != tail)
+			return;
+		asyncPause(&spins);
+	}
+	__atomic_store_n(&asyncSleeping, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&asyncHead, __ATOMIC_SEQ_CST) == tail)
+		syscall(SYS_futex, &asyncHead, FUTEX_WAIT_PRIVATE, tail, NULL, NULL, 0);
+	__atomic_store_n(&asyncSleeping, 0, __ATOMIC_RELAXED);
+}
 
-		if (clock_may_race(currClock, thread, writeClock, writeThread)) {
-			/* We have a datarace */
-			race = reportDataRace(writeThread, writeClock, true, get_execution()->get_parent_action(thread), false, location);
+/**
+ * The race helper thread (-A).  It checks queued accesses in order against
+ * the clocks of their threads, which cannot change until the queue is
+ * drained, and keeps the races it finds for the user thread to report.
+ */
+static void * raceHelper(void *arg)
+{
+	asyncHelper = true;
+	unsigned int tail = __atomic_load_n(&asyncTail, __ATOMIC_RELAXED);
+	while (true) {
+		unsigned int head = __atomic_load_n(&asyncHead, __ATOMIC_ACQUIRE);
+		if (head == tail) {
+			waitForAccesses(tail);
+			continue;
 		}
-
-		modelclock_t readClock = READVECTOR(shadowval);
-		thread_id_t readThread = int_to_id(RDTHREADID(shadowval));
-
-		if (clock_may_race(currClock, thread, readClock, readThread)) {
-			/* We don't subsume this read... Have to expand record. */
-			expandRecord(shadow);
-			struct RaceRecord *record = (struct RaceRecord *) (*shadow);
-			record->thread[1] = thread;
-			record->readClock[1] = ourClock;
-			record->numReads++;
-
-			goto Exit;
+		for (;tail != head;tail++) {
+			struct RaceAccess *access = &asyncRing[tail & (ASYNCRINGSIZE - 1)];
+			struct DataRace *race = accessRange(access->iswrite ? ACCESS_WRITE : ACCESS_READ, access->thread, access->location, access->size);
+			if (race && raceFilterSeen(race, access->pc)) {
+				model_free(race);
+			} else if (race) {
+				/* The stack of the access is gone; its call site stands in
+				   for the backtrace */
+				race->numframes = FIRST_STACK_FRAME + 1;
+				for (int i = 0;i < FIRST_STACK_FRAME;i++)
+					race->backtrace[i] = NULL;
+				race->backtrace[FIRST_STACK_FRAME] = (void *)access->pc;
+				asyncRaces->push_back(race);
+			}
 		}
-
-		*shadow = ENCODEOP(threadid, ourClock, id_to_int(writeThread), writeClock) | (shadowval & ATOMICMASK);
-	}
-Exit:
-	if (race) {
-#ifdef REPORT_DATA_RACES
-		race->numframes=backtrace(race->backtrace, sizeof(race->backtrace)/sizeof(void*));
-		if (raceset->add(race))
-			assert_race(race);
-		else model_free(race);
-#else
-		model_free(race);
-#endif
+		__atomic_store_n(&asyncTail, tail, __ATOMIC_RELEASE);
 	}
+	return NULL;
 }
 
-void raceCheckRead64(thread_id_t thread, const void *location)
+static void startRaceHelper()
 {
-	uint64_t old_shadowval, new_shadowval;
-	old_shadowval = new_shadowval = INVALIDSHADOWVAL;
-#ifdef COLLECT_STAT
-	load64_count++;
-#endif
-	uint64_t * shadow = raceCheckRead_firstIt(thread, location, &old_shadowval, &new_shadowval);
-	if (CHECKBOUNDARY(location, 7)) {
-		if (shadow[1]==old_shadowval)
-			shadow[1] = new_shadowval;
-		else goto L1;
-		if (shadow[2]==old_shadowval)
-			shadow[2] = new_shadowval;
-		else goto L2;
-		if (shadow[3]==old_shadowval)
-			shadow[3] = new_shadowval;
-		else goto L3;
-		if (shadow[4]==old_shadowval)
-			shadow[4] = new_shadowval;
-		else goto L4;
-		if (shadow[5]==old_shadowval)
-			shadow[5] = new_shadowval;
-		else goto L5;
-		if (shadow[6]==old_shadowval)
-			shadow[6] = new_shadowval;
-		else goto L6;
-		if (shadow[7]==old_shadowval)
-			shadow[7] = new_shadowval;
-		else goto L7;
-		return;
+	pthread_t helper;
+	real_init_all();
+	if (real_pthread_create(&helper, &asyncAttr, raceHelper, NULL) != 0) {
+		perror("pthread_create");
+		exit(EXIT_FAILURE);
 	}
-
-L1:
-	raceCheckRead_otherIt(thread, (const void *)(((uintptr_t)location) + 1));
-L2:
-	raceCheckRead_otherIt(thread, (const void *)(((uintptr_t)location) + 2));
-L3:
-	raceCheckRead_otherIt(thread, (const void *)(((uintptr_t)location) + 3));
-L4:
-	raceCheckRead_otherIt(thread, (const void *)(((uintptr_t)location) + 4));
-L5:
-	raceCheckRead_otherIt(thread, (const void *)(((uintptr_t)location) + 5));
-L6:
-	raceCheckRead_otherIt(thread, (const void *)(((uintptr_t)location) + 6));
-L7:
-	raceCheckRead_otherIt(thread, (const void *)(((uintptr_t)location) + 7));
+	asyncStarted = true;
 }
 
-void raceCheckRead32(thread_id_t thread, const void *location)
+/** Appends an access to the queue of the helper thread. */
+static inline void raceQueue(bool iswrite, thread_id_t thread, const void *location, size_t size, const void *pc)
 {
-	uint64_t old_shadowval, new_shadowval;
-	old_shadowval = new_shadowval = INVALIDSHADOWVAL;
-#ifdef COLLECT_STAT
-	load32_count++;
-#endif
-	uint64_t * shadow = raceCheckRead_firstIt(thread, location, &old_shadowval, &new_shadowval);
-	if (CHECKBOUNDARY(location, 3)) {
-		if (shadow[1]==old_shadowval)
-			shadow[1] = new_shadowval;
-		else goto L1;
-		if (shadow[2]==old_shadowval)
-			shadow[2] = new_shadowval;
-		else goto L2;
-		if (shadow[3]==old_shadowval)
-			shadow[3] = new_shadowval;
-		else goto L3;
-		return;
+	if (!asyncStarted)
+		startRaceHelper();
+	unsigned int head = asyncHead;
+	unsigned int spins = 0;
+	while (head - __atomic_load_n(&asyncTail, __ATOMIC_ACQUIRE) == ASYNCRINGSIZE) {
+		kickRaceHelper();
+		asyncPause(&spins);
 	}
-
-L1:
-	raceCheckRead_otherIt(thread, (const void *)(((uintptr_t)location) + 1));
-L2:
-	raceCheckRead_otherIt(thread, (const void *)(((uintptr_t)location) + 2));
-L3:
-	raceCheckRead_otherIt(thread, (const void *)(((uintptr_t)location) + 3));
+	struct RaceAccess *access = &asyncRing[head & (ASYNCRINGSIZE - 1)];
+	access->location = location;
+	access->pc = pc;
+	access->size = size;
+	access->thread = thread;
+	access->iswrite = iswrite;
+	__atomic_store_n(&asyncHead, head + 1, __ATOMIC_RELEASE);
+	kickRaceHelper();
 }
 
-void raceCheckRead16(thread_id_t thread, const void *location)
+/** Queues a plain read of size bytes, made at pc, for the helper thread. */
+void raceQueueRead(thread_id_t thread, const void *location, size_t size, const void *pc)
 {
-	uint64_t old_shadowval, new_shadowval;
-	old_shadowval = new_shadowval = INVALIDSHADOWVAL;
-#ifdef COLLECT_STAT
-	load16_count++;
-#endif
-	uint64_t * shadow = raceCheckRead_firstIt(thread, location, &old_shadowval, &new_shadowval);
-	if (CHECKBOUNDARY(location, 1)) {
-		if (shadow[1]==old_shadowval) {
-			shadow[1] = new_shadowval;
-			return;
-		}
-	}
-	raceCheckRead_otherIt(thread, (const void *)(((uintptr_t)location) + 1));
+	raceQueue(false, thread, location, size, pc);
 }
 
-void raceCheckRead8(thread_id_t thread, const void *location)
+/** Queues a plain write of size bytes, made at pc, for the helper thread. */
+void raceQueueWrite(thread_id_t thread, const void *location, size_t size, const void *pc)
 {
-	uint64_t old_shadowval, new_shadowval;
-	old_shadowval = new_shadowval = INVALIDSHADOWVAL;
-#ifdef COLLECT_STAT
-	load8_count++;
-#endif
-	raceCheckRead_firstIt(thread, location, &old_shadowval, &new_shadowval);
+	raceQueue(true, thread, location, size, pc);
 }
 
-static inline uint64_t * raceCheckWrite_firstIt(thread_id_t thread, const void * location, uint64_t *old_val, uint64_t *new_val)
+/**
+ * Waits for the helper thread to check every queued access, then reports
+ * the races it found.  This runs before any action changes a clock and
+ * before the model-checker allocates from user context, as the helper
+ * shares both heaps.  The allocators themselves do not check, so that
+ * runs without -A pay nothing for it.
+ */
+void raceAsyncDrain()
 {
-	uint64_t *shadow = lookupAddressEntry(location);
-	uint64_t shadowval = *shadow;
-	ClockVector *currClock = get_execution()->get_cv(thread);
-	if (currClock == NULL)
-		return shadow;
-
-	struct DataRace * race = NULL;
-	/* Do full record */
-	if (shadowval != 0 && !ISSHORTRECORD(shadowval)) {
-		race = fullRaceCheckWrite(thread, location, shadow, currClock);
-		goto Exit;
+	if (asyncHelper)
+		return;
+	unsigned int head = asyncHead;
+	unsigned int spins = 0;
+	while (__atomic_load_n(&asyncTail, __ATOMIC_ACQUIRE) != head) {
+		kickRaceHelper();
+		asyncPause(&spins);
 	}
+	/* Reporting allocates, which drains again */
+	if (asyncDraining || asyncRaces->size() == 0)
+		return;
+	asyncDraining = true;
+	for (uint i = 0;i < asyncRaces->size();i++)
+		addRace((*asyncRaces)[i]);
+	asyncRaces->clear();
+	asyncDraining = false;
+}
 
-	{
-		int threadid = id_to_int(thread);
-		modelclock_t ourClock = currClock->getClock(thread);
+/** This function does race detection on a write. */
+void raceCheckWrite(thread_id_t thread, void *location)
+{
+	RACEQUIESCE();
+	struct DataRace *race = accessShadow(ACCESS_WRITE, thread, location, 1);
+	if (race)
+		processRace(race, __builtin_return_address(0));
+}
 
-		/* Thread ID is too large or clock is too large. */
-		if (threadid > MAXTHREADID || ourClock > MAXWRITEVECTOR) {
-			expandRecord(shadow);
-			race = fullRaceCheckWrite(thread, location, shadow, currClock);
-			goto Exit;
-		}
+/** This function does race detection on an atomic write of size bytes. */
+void atomraceCheckWrite(thread_id_t thread, void *location, unsigned int size)
+{
+	RACEQUIESCE();
+	struct DataRace *race = accessShadow(ACCESS_ATOMIC_WRITE, thread, location, size);
+	if (race)
+		processRace(race, __builtin_return_address(0));
+}
 
-		{
-			/* Check for datarace against last read. */
-			modelclock_t readClock = READVECTOR(shadowval);
-			thread_id_t readThread = int_to_id(RDTHREADID(shadowval));
+/** This function just updates metadata on an atomic write of size bytes. */
+void recordWrite(thread_id_t thread, void *location, unsigned int size)
+{
+	RACEQUIESCE();
+	accessShadow(ACCESS_RECORD_WRITE, thread, location, size);
+}
 
-			if (clock_may_race(currClock, thread, readClock, readThread)) {
-				/* We have a datarace */
-				race = reportDataRace(readThread, readClock, false, get_execution()->get_parent_action(thread), true, location);
-				goto ShadowExit;
-			}
-		}
+/** This function just updates metadata on a calloc. */
+void recordCalloc(void *location, size_t size)
+{
+	RACEQUIESCE();
+	accessRange(ACCESS_CALLOC, thread_current_id(), location, size);
+}
 
-		{
-			/* Check for datarace against last write. */
-			modelclock_t writeClock = WRITEVECTOR(shadowval);
-			thread_id_t writeThread = int_to_id(WRTHREADID(shadowval));
+/** This function does race detection on a read of size bytes, such as the
+ *  source of a memcpy. */
+void raceCheckReadRange(thread_id_t thread, const void *location, size_t size, const void *pc)
+{
+	struct DataRace *race = accessRange(ACCESS_READ, thread, location, size);
+	if (race)
+		processRace(race, pc);
+}
 
-			if (clock_may_race(currClock, thread, writeClock, writeThread)) {
-				/* We have a datarace */
-				race = reportDataRace(writeThread, writeClock, true, get_execution()->get_parent_action(thread), true, location);
-				goto ShadowExit;
-			}
-		}
+/** This function does race detection on a write of size bytes, such as the
+ *  destination of a memcpy or memset. */
+void raceCheckWriteRange(thread_id_t thread, const void *location, size_t size, const void *pc)
+{
+	struct DataRace *race = accessRange(ACCESS_WRITE, thread, location, size);
+	if (race)
+		processRace(race, pc);
+}
 
-ShadowExit:
-		*shadow = ENCODEOP(0, 0, threadid, ourClock);
+/** This function does race detection on a read. */
+void raceCheckRead(thread_id_t thread, const void *location)
+{
+	RACEQUIESCE();
+	struct DataRace *race = accessShadow(ACCESS_READ, thread, location, 1);
+	if (race)
+		processRace(race, __builtin_return_address(0));
+}
 
-		*old_val = shadowval;
-		*new_val = *shadow;
-	}
+/** This function does race detection on an atomic read of size bytes. */
+void atomraceCheckRead(thread_id_t thread, const void *location, unsigned int size)
+{
+	RACEQUIESCE();
+	struct DataRace *race = accessShadow(ACCESS_ATOMIC_READ, thread, location, size);
+	if (race)
+		processRace(race, __builtin_return_address(0));
+}
 
-Exit:
-	if (race) {
-#ifdef REPORT_DATA_RACES
-		race->numframes=backtrace(race->backtrace, sizeof(race->backtrace)/sizeof(void*));
-		if (raceset->add(race))
-			assert_race(race);
-		else model_free(race);
-#else
-		model_free(race);
+void raceCheckRead64(thread_id_t thread, const void *location, const void *pc)
+{
+#ifdef COLLECT_STAT
+	load64_count++;
 #endif
-	}
-
-	return shadow;
+	struct DataRace *race = accessShadow(ACCESS_READ, thread, location, 8);
+	if (race)
+		processRace(race, pc);
 }
 
-static inline void raceCheckWrite_otherIt(thread_id_t thread, const void * location) {
-	uint64_t *shadow = lookupAddressEntry(location);
-
-	uint64_t shadowval = *shadow;
-
-	ClockVector *currClock = get_execution()->get_cv(thread);
-	if (currClock == NULL)
-		return;
-
-	struct DataRace * race = NULL;
-	/* Do full record */
-	if (shadowval != 0 && !ISSHORTRECORD(shadowval)) {
-		race = fullRaceCheckWrite(thread, location, shadow, currClock);
-		goto Exit;
-	}
-
-	{
-		int threadid = id_to_int(thread);
-		modelclock_t ourClock = currClock->getClock(thread);
-
-		/* Thread ID is too large or clock is too large. */
-		if (threadid > MAXTHREADID || ourClock > MAXWRITEVECTOR) {
-			expandRecord(shadow);
-			race = fullRaceCheckWrite(thread, location, shadow, currClock);
-			goto Exit;
-		}
-
-		{
-			/* Check for datarace against last read. */
-			modelclock_t readClock = READVECTOR(shadowval);
-			thread_id_t readThread = int_to_id(RDTHREADID(shadowval));
-
-			if (clock_may_race(currClock, thread, readClock, readThread)) {
-				/* We have a datarace */
-				race = reportDataRace(readThread, readClock, false, get_execution()->get_parent_action(thread), true, location);
-				goto ShadowExit;
-			}
-		}
-
-		{
-			/* Check for datarace against last write. */
-			modelclock_t writeClock = WRITEVECTOR(shadowval);
-			thread_id_t writeThread = int_to_id(WRTHREADID(shadowval));
-
-			if (clock_may_race(currClock, thread, writeClock, writeThread)) {
-				/* We have a datarace */
-				race = reportDataRace(writeThread, writeClock, true, get_execution()->get_parent_action(thread), true, location);
-				goto ShadowExit;
-			}
-		}
+void raceCheckRead32(thread_id_t thread, const void *location, const void *pc)
+{
+#ifdef COLLECT_STAT
+	load32_count++;
+#endif
+	struct DataRace *race = accessShadow(ACCESS_READ, thread, location, 4);
+	if (race)
+		processRace(race, pc);
+}
 
-ShadowExit:
-		*shadow = ENCODEOP(0, 0, threadid, ourClock);
-	}
+void raceCheckRead16(thread_id_t thread, const void *location, const void *pc)
+{
+#ifdef COLLECT_STAT
+	load16_count++;
+#endif
+	struct DataRace *race = accessShadow(ACCESS_READ, thread, location, 2);
+	if (race)
+		processRace(race, pc);
+}
 
-Exit:
-	if (race) {
-#ifdef REPORT_DATA_RACES
-		race->numframes=backtrace(race->backtrace, sizeof(race->backtrace)/sizeof(void*));
-		if (raceset->add(race))
-			assert_race(race);
-		else model_free(race);
-#else
-		model_free(race);
+void raceCheckRead8(thread_id_t thread, const void *location, const void *pc)
+{
+#ifdef COLLECT_STAT
+	load8_count++;
 #endif
-	}
+	struct DataRace *race = accessShadow(ACCESS_READ, thread, location, 1);
+	if (race)
+		processRace(race, pc);
 }
 
-void raceCheckWrite64(thread_id_t thread, const void *location)
+void raceCheckWrite64(thread_id_t thread, const void *location, const void *pc)
 {
-	uint64_t old_shadowval, new_shadowval;
-	old_shadowval = new_shadowval = INVALIDSHADOWVAL;
 #ifdef COLLECT_STAT
 	store64_count++;
 #endif
-	uint64_t * shadow = raceCheckWrite_firstIt(thread, location, &old_shadowval, &new_shadowval);
-	if (CHECKBOUNDARY(location, 7)) {
-		if (shadow[1]==old_shadowval)
-			shadow[1] = new_shadowval;
-		else goto L1;
-		if (shadow[2]==old_shadowval)
-			shadow[2] = new_shadowval;
-		else goto L2;
-		if (shadow[3]==old_shadowval)
-			shadow[3] = new_shadowval;
-		else goto L3;
-		if (shadow[4]==old_shadowval)
-			shadow[4] = new_shadowval;
-		else goto L4;
-		if (shadow[5]==old_shadowval)
-			shadow[5] = new_shadowval;
-		else goto L5;
-		if (shadow[6]==old_shadowval)
-			shadow[6] = new_shadowval;
-		else goto L6;
-		if (shadow[7]==old_shadowval)
-			shadow[7] = new_shadowval;
-		else goto L7;
-		return;
-	}
-
-L1:
-	raceCheckWrite_otherIt(thread, (const void *)(((uintptr_t)location) + 1));
-L2:
-	raceCheckWrite_otherIt(thread, (const void *)(((uintptr_t)location) + 2));
-L3:
-	raceCheckWrite_otherIt(thread, (const void *)(((uintptr_t)location) + 3));
-L4:
-	raceCheckWrite_otherIt(thread, (const void *)(((uintptr_t)location) + 4));
-L5:
-	raceCheckWrite_otherIt(thread, (const void *)(((uintptr_t)location) + 5));
-L6:
-	raceCheckWrite_otherIt(thread, (const void *)(((uintptr_t)location) + 6));
-L7:
-	raceCheckWrite_otherIt(thread, (const void *)(((uintptr_t)location) + 7));
+	struct DataRace *race = accessShadow(ACCESS_WRITE, thread, location, 8);
+	if (race)
+		processRace(race, pc);
 }
 
-void raceCheckWrite32(thread_id_t thread, const void *location)
+void raceCheckWrite32(thread_id_t thread, const void *location, const void *pc)
 {
-	uint64_t old_shadowval, new_shadowval;
-	old_shadowval = new_shadowval = INVALIDSHADOWVAL;
 #ifdef COLLECT_STAT
 	store32_count++;
 #endif
-	uint64_t * shadow = raceCheckWrite_firstIt(thread, location, &old_shadowval, &new_shadowval);
-	if (CHECKBOUNDARY(location, 3)) {
-		if (shadow[1]==old_shadowval)
-			shadow[1] = new_shadowval;
-		else goto L1;
-		if (shadow[2]==old_shadowval)
-			shadow[2] = new_shadowval;
-		else goto L2;
-		if (shadow[3]==old_shadowval)
-			shadow[3] = new_shadowval;
-		else goto L3;
-		return;
-	}
-
-L1:
-	raceCheckWrite_otherIt(thread, (const void *)(((uintptr_t)location) + 1));
-L2:
-	raceCheckWrite_otherIt(thread, (const void *)(((uintptr_t)location) + 2));
-L3:
-	raceCheckWrite_otherIt(thread, (const void *)(((uintptr_t)location) + 3));
+	struct DataRace *race = accessShadow(ACCESS_WRITE, thread, location, 4);
+	if (race)
+		processRace(race, pc);
 }
 
-void raceCheckWrite16(thread_id_t thread, const void *location)
+void raceCheckWrite16(thread_id_t thread, const void *location, const void *pc)
 {
-	uint64_t old_shadowval, new_shadowval;
-	old_shadowval = new_shadowval = INVALIDSHADOWVAL;
 #ifdef COLLECT_STAT
 	store16_count++;
 #endif
-
-	uint64_t * shadow = raceCheckWrite_firstIt(thread, location, &old_shadowval, &new_shadowval);
-	if (CHECKBOUNDARY(location, 1)) {
-		if (shadow[1]==old_shadowval) {
-			shadow[1] = new_shadowval;
-			return;
-		}
-	}
-	raceCheckWrite_otherIt(thread, (const void *)(((uintptr_t)location) + 1));
+	struct DataRace *race = accessShadow(ACCESS_WRITE, thread, location, 2);
+	if (race)
+		processRace(race, pc);
 }
 
-void raceCheckWrite8(thread_id_t thread, const void *location)
+void raceCheckWrite8(thread_id_t thread, const void *location, const void *pc)
 {
-	uint64_t old_shadowval, new_shadowval;
-	old_shadowval = new_shadowval = INVALIDSHADOWVAL;
 #ifdef COLLECT_STAT
 	store8_count++;
 #endif
-	raceCheckWrite_firstIt(thread, location, &old_shadowval, &new_shadowval);
+	struct DataRace *race = accessShadow(ACCESS_WRITE, thread, location, 1);
+	if (race)
+		processRace(race, pc);
 }
 
 #ifdef COLLECT_STAT
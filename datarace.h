@@ -11,14 +11,26 @@
 #include "classlist.h"
 #include "hashset.h"
 
+struct model_params;
+
 struct ShadowTable {
 	void * array[65536];
 };
 
+/** Shadow memory keeps one cell per aligned 8-byte granule; a cell is one
+ *  word, or two with -W */
+#define GRANULESHIFT 3
+#define GRANULESIZE (1 << GRANULESHIFT)
+#define GRANULEMASK (GRANULESIZE - 1)
+
 struct ShadowBaseTable {
-	uint64_t array[65536];
+	uint64_t array[65536 >> GRANULESHIFT];
 };
 
+/** With -F, the granule cell of an address is at this offset, times the
+ *  words per cell, in one flat region instead of in the shadow tables */
+#define FLATSHADOWMASK ((uintptr_t)(FLATSHADOWSIZE - 1) & ~(uintptr_t)GRANULEMASK)
+
 struct DataRace {
 	/* Clock and thread associated with first action.  This won't change in
 	         response to synchronization. */
@@ -28,9 +40,11 @@ struct DataRace {
 	/* Record whether this is a write, so we can tell the user. */
 	bool isoldwrite;
 
-	/* Model action associated with second action.  This could change as
-	         a result of synchronization. */
-	ModelAction *newaction;
+	/* Thread and sequence number of the second action.  These are taken
+	         when the race is found, as races are printed at the end of the
+	         run. */
+	thread_id_t newthread;
+	modelclock_t newseqnum;
 	/* Record whether this is a write, so we can tell the user. */
 	bool isnewwrite;
 
@@ -42,50 +56,132 @@ struct DataRace {
 
 #define MASK16BIT 0xffff
 
-void initRaceDetector();
+/** @brief Counters of the race detector's work over all executions */
+struct race_stats {
+	uint64_t compact_checks;	/**< @brief Checks of compact shadow records */
+	uint64_t full_checks;	/**< @brief Checks of full RaceRecords */
+	uint64_t expansions;	/**< @brief Compact records expanded to RaceRecords */
+	uint64_t read_growths;	/**< @brief Times a RaceRecord's read set grew */
+	uint64_t split_granules;	/**< @brief Granules split by mixed-size accesses */
+	uint64_t shadow_tables;	/**< @brief Shadow tables allocated */
+	uint64_t shadow_bytes;	/**< @brief Bytes of those shadow tables */
+	uint64_t races_found;	/**< @brief Races found, duplicates included */
+	uint64_t races_filtered;	/**< @brief Repeats dropped before unwinding the stack */
+	uint64_t races_rejected;	/**< @brief Races the race set rejected as duplicates */
+};
+
+void initRaceDetector(const struct model_params *params);
+const struct race_stats * getRaceStats();
+bool raceSampleSite(const void *pc);
+
+/** Whether race checks are sampled per call site (-R) */
+extern bool raceSampling;
+
+/** Whether the instrumented access whose return address is pc should be
+ *  race checked */
+#define RACESAMPLED(pc) (!raceSampling || raceSampleSite(pc))
+
+/** Whether plain accesses to the running thread's own stack skip race
+ *  checks (-P) */
+extern bool raceSkipStack;
+bool raceOwnStack(const void *location);
+
+/** Code pages whose plain accesses skip race checks (-X), two bits a page:
+ *  SUPPRESSPARTIAL if some of the page's code is suppressed and
+ *  SUPPRESSWHOLE if all of it is */
+extern unsigned char *suppressPages;
+bool raceSuppressedSite(const void *pc);
+
+#define SUPPRESSPAGESHIFT 12
+#define SUPPRESSADDRESSLIMIT (1ULL << 47)
+#define SUPPRESSPAGESSIZE (SUPPRESSADDRESSLIMIT >> (SUPPRESSPAGESHIFT + 2))
+#define SUPPRESSPARTIAL 0x1
+#define SUPPRESSWHOLE 0x3
+#define SUPPRESSBITS(pc) ((suppressPages[(uintptr_t)(pc) >> (SUPPRESSPAGESHIFT + 2)] >> ((((uintptr_t)(pc) >> SUPPRESSPAGESHIFT) & 3) * 2)) & SUPPRESSWHOLE)
+
+/** Whether the instrumented access whose return address is pc is in
+ *  suppressed code */
+static inline bool raceSuppressed(const void *pc)
+{
+	if (suppressPages == NULL)
+		return false;
+	unsigned int bits = SUPPRESSBITS(pc);
+	return bits == SUPPRESSWHOLE || (bits == SUPPRESSPARTIAL && raceSuppressedSite(pc));
+}
+
+/** Whether the instrumented access to location whose return address is pc
+ *  should be race checked */
+#define RACECHECKED(location, pc) (!raceSuppressed(pc) && !(raceSkipStack && raceOwnStack(location)) && RACESAMPLED(pc))
+
+/** Whether plain accesses are race checked on a helper thread (-A) */
+extern bool raceAsync;
+void raceQueueRead(thread_id_t thread, const void *location, size_t size, const void *pc);
+void raceQueueWrite(thread_id_t thread, const void *location, size_t size, const void *pc);
+void raceAsyncDrain();
+
+/** Waits until the race helper thread has checked every queued access, so
+ *  that the model state and heaps it uses are this thread's again.  Every
+ *  entry point that allocates before switch_thread() needs one. */
+#define RACEQUIESCE() do { if (raceAsync) raceAsyncDrain(); } while (0)
+void resetRaceDetector();
 void raceCheckWrite(thread_id_t thread, void *location);
-void atomraceCheckWrite(thread_id_t thread, void *location);
+void atomraceCheckWrite(thread_id_t thread, void *location, unsigned int size);
 void raceCheckRead(thread_id_t thread, const void *location);
 
-void atomraceCheckRead(thread_id_t thread, const void *location);
-void recordWrite(thread_id_t thread, void *location);
+void atomraceCheckRead(thread_id_t thread, const void *location, unsigned int size);
+void recordWrite(thread_id_t thread, void *location, unsigned int size);
 void recordCalloc(void *location, size_t size);
-void assert_race(struct DataRace *race);
+void printRaces();
 bool hasNonAtomicStore(const void *location);
 void setAtomicStoreFlag(const void *location);
 void getStoreThreadAndClock(const void *address, thread_id_t * thread, modelclock_t * clock);
 
-void raceCheckRead8(thread_id_t thread, const void *location);
-void raceCheckRead16(thread_id_t thread, const void *location);
-void raceCheckRead32(thread_id_t thread, const void *location);
-void raceCheckRead64(thread_id_t thread, const void *location);
+void raceCheckRead8(thread_id_t thread, const void *location, const void *pc);
+void raceCheckRead16(thread_id_t thread, const void *location, const void *pc);
+void raceCheckRead32(thread_id_t thread, const void *location, const void *pc);
+void raceCheckRead64(thread_id_t thread, const void *location, const void *pc);
+
+void raceCheckWrite8(thread_id_t thread, const void *location, const void *pc);
+void raceCheckWrite16(thread_id_t thread, const void *location, const void *pc);
+void raceCheckWrite32(thread_id_t thread, const void *location, const void *pc);
+void raceCheckWrite64(thread_id_t thread, const void *location, const void *pc);
 
-void raceCheckWrite8(thread_id_t thread, const void *location);
-void raceCheckWrite16(thread_id_t thread, const void *location);
-void raceCheckWrite32(thread_id_t thread, const void *location);
-void raceCheckWrite64(thread_id_t thread, const void *location);
+void raceCheckReadRange(thread_id_t thread, const void *location, size_t size, const void *pc);
+void raceCheckWriteRange(thread_id_t thread, const void *location, size_t size, const void *pc);
 
 #ifdef COLLECT_STAT
 void print_normal_accesses();
 #endif
 
+/** Reads of a RaceRecord that fit inside it */
+#define INITCAPACITY 4
+
+/** A read in the read set of a RaceRecord */
+struct RaceRead {
+	thread_id_t thread;
+	modelclock_t clock;
+};
+
 /**
  * @brief A record of information for detecting data races
  */
 struct RaceRecord {
-	modelclock_t *readClock;
-	thread_id_t *thread;
 	int numReads : 31;
 	int isAtomic : 1;
+	/** Reads that fit in the read set; past INITCAPACITY they are in a
+	 *  pooled block */
+	int capacity;
 	thread_id_t writeThread;
 	modelclock_t writeClock;
+	union {
+		struct RaceRead inlineReads[INITCAPACITY];
+		struct RaceRead *pooledReads;
+	};
 };
 
 unsigned int race_hash(struct DataRace *race);
 bool race_equals(struct DataRace *r1, struct DataRace *r2);
 
-#define INITCAPACITY 4
-
 #define ISSHORTRECORD(x) ((x)&0x1)
 
 #define THREADMASK 0x3f
@@ -103,6 +199,8 @@ bool race_equals(struct DataRace *r1, struct DataRace *r2);
 
 /**
  * The basic encoding idea is that (void *) either:
+ *  -# is tagged with SPLITTAG and points to the eight per-byte words of a
+ *     granule that saw accesses of mixed sizes,
  *  -# points to a full record (RaceRecord) or
  *  -# encodes the information in a 64 bit word. Encoding is as
  *     follows:
@@ -119,8 +217,31 @@ bool race_equals(struct DataRace *r1, struct DataRace *r2);
 #define MAXREADVECTOR (READMASK-1)
 #define MAXWRITEVECTOR (WRITEMASK-1)
 
-#define INVALIDSHADOWVAL 0x2ULL
-#define CHECKBOUNDARY(location, bits) ((((uintptr_t)location & MASK16BIT) + bits) <= MASK16BIT)
+/**
+ * With -W, a compact record takes two words so that thread ids and clocks
+ * past the limits above stay compact:
+ *  - first word: lowest bit set to 1, next 16 bits are read thread id and
+ *    the remaining 47 bits are read clock vector
+ *  - second word: lowest 16 bits are write thread id, next 47 bits are
+ *    write clock vector and highest bit is 1 if the write is from an atomic
+ */
+#define WIDETHREADMASK 0xffff
+#define WIDECLOCKMASK ((1ULL << 47) - 1)
+#define WIDERDTHREADID(x) (((x)>>1)&WIDETHREADMASK)
+#define WIDEREADVECTOR(x) (((x)>>17)&WIDECLOCKMASK)
+#define WIDEWRTHREADID(x) ((x)&WIDETHREADMASK)
+#define WIDEWRITEVECTOR(x) (((x)>>16)&WIDECLOCKMASK)
+
+#define WIDEENCODEREAD(rdthread, rdtime) (0x1ULL | (((uint64_t)rdthread)<<1) | (((uint64_t)rdtime)<<17))
+#define WIDEENCODEWRITE(wrthread, wrtime) (((uint64_t)wrthread) | (((uint64_t)wrtime)<<16))
+
+#define MAXWIDETHREADID (WIDETHREADMASK-1)
+#define MAXWIDEVECTOR (WIDECLOCKMASK-1)
+
+#define SPLITTAG 0x2ULL
+#define ISSPLITGRANULE(x) (((x) & 0x3) == SPLITTAG)
+#define SPLITGRANULE(bytes) (((uint64_t)(bytes)) | SPLITTAG)
+#define GRANULEBYTES(x) ((uint64_t *)((x) & ~SPLITTAG))
 
 typedef HashSet<struct DataRace *, uintptr_t, 0, model_malloc, model_calloc, model_free, race_hash, race_equals> RaceSet;
 
@@ -394,6 +394,9 @@ bool ModelExecution::process_read(ModelAction *curr, SnapVector<ModelAction *> *
 	                i++;
 	   }*/
 
+	if (rf_set->size() > 1)
+		model->branch_point();
+
 	while(true) {
 		int index = fuzzer->selectWrite(curr, rf_set);
 
@@ -18,6 +18,7 @@
 #include "model.h"
 #include "execution.h"
 #include "mutex.h"
+#include "datarace.h"
 #include <condition_variable>
 
 // Constants for the wait/wake futex syscall operations
@@ -43,6 +44,7 @@ namespace std _GLIBCXX_VISIBILITY(default)
 			return true;
 		}
 
+		RACEQUIESCE();
 		ModelExecution *execution = model->get_execution();
 
 		cdsc::snapcondition_variable *v = new cdsc::snapcondition_variable();
@@ -115,6 +115,11 @@ void cds_atomic_thread_fence(int atomic_index, const char * position);
 void cds_func_entry(const char * funcName);
 void cds_func_exit(const char * funcName);
 
+/* Restart every later execution from this point (call before creating threads) */
+void c11tester_checkpoint();
+/* Function that resets the program's state between executions in no-fork mode */
+void c11tester_set_reset_hook(void (*hook)());
+
 #if __cplusplus
 }
 #endif
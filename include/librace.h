@@ -6,6 +6,7 @@
 #define __LIBRACE_H__
 
 #include <stdint.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -31,6 +32,9 @@ void cds_load16(const void *addr);
 void cds_load32(const void *addr);
 void cds_load64(const void *addr);
 
+void cds_load_range(const void *addr, size_t size);
+void cds_store_range(void *addr, size_t size);
+
 #ifdef __cplusplus
 }
 #endif
@@ -12,7 +12,13 @@ void store_8(void *addr, uint8_t val)
 {
 	DEBUG("addr = %p, val = %" PRIu8 "\n", addr, val);
 	thread_id_t tid = thread_current_id();
-	raceCheckWrite(tid, addr);
+	const void *pc = __builtin_return_address(0);
+	if (RACECHECKED(addr, pc)) {
+		if (raceAsync)
+			raceQueueWrite(tid, addr, 1, pc);
+		else
+			raceCheckWrite8(tid, addr, pc);
+	}
 	(*(uint8_t *)addr) = val;
 }
 
@@ -20,8 +26,13 @@ void store_16(void *addr, uint16_t val)
 {
 	DEBUG("addr = %p, val = %" PRIu16 "\n", addr, val);
 	thread_id_t tid = thread_current_id();
-	raceCheckWrite(tid, addr);
-	raceCheckWrite(tid, (void *)(((uintptr_t)addr) + 1));
+	const void *pc = __builtin_return_address(0);
+	if (RACECHECKED(addr, pc)) {
+		if (raceAsync)
+			raceQueueWrite(tid, addr, 2, pc);
+		else
+			raceCheckWrite16(tid, addr, pc);
+	}
 	(*(uint16_t *)addr) = val;
 }
 
@@ -29,10 +40,13 @@ void store_32(void *addr, uint32_t val)
 {
 	DEBUG("addr = %p, val = %" PRIu32 "\n", addr, val);
 	thread_id_t tid = thread_current_id();
-	raceCheckWrite(tid, addr);
-	raceCheckWrite(tid, (void *)(((uintptr_t)addr) + 1));
-	raceCheckWrite(tid, (void *)(((uintptr_t)addr) + 2));
-	raceCheckWrite(tid, (void *)(((uintptr_t)addr) + 3));
+	const void *pc = __builtin_return_address(0);
+	if (RACECHECKED(addr, pc)) {
+		if (raceAsync)
+			raceQueueWrite(tid, addr, 4, pc);
+		else
+			raceCheckWrite32(tid, addr, pc);
+	}
 	(*(uint32_t *)addr) = val;
 }
 
@@ -40,14 +54,13 @@ void store_64(void *addr, uint64_t val)
 {
 	DEBUG("addr = %p, val = %" PRIu64 "\n", addr, val);
 	thread_id_t tid = thread_current_id();
-	raceCheckWrite(tid, addr);
-	raceCheckWrite(tid, (void *)(((uintptr_t)addr) + 1));
-	raceCheckWrite(tid, (void *)(((uintptr_t)addr) + 2));
-	raceCheckWrite(tid, (void *)(((uintptr_t)addr) + 3));
-	raceCheckWrite(tid, (void *)(((uintptr_t)addr) + 4));
-	raceCheckWrite(tid, (void *)(((uintptr_t)addr) + 5));
-	raceCheckWrite(tid, (void *)(((uintptr_t)addr) + 6));
-	raceCheckWrite(tid, (void *)(((uintptr_t)addr) + 7));
+	const void *pc = __builtin_return_address(0);
+	if (RACECHECKED(addr, pc)) {
+		if (raceAsync)
+			raceQueueWrite(tid, addr, 8, pc);
+		else
+			raceCheckWrite64(tid, addr, pc);
+	}
 	(*(uint64_t *)addr) = val;
 }
 
@@ -55,7 +68,13 @@ uint8_t load_8(const void *addr)
 {
 	DEBUG("addr = %p\n", addr);
 	thread_id_t tid = thread_current_id();
-	raceCheckRead(tid, addr);
+	const void *pc = __builtin_return_address(0);
+	if (RACECHECKED(addr, pc)) {
+		if (raceAsync)
+			raceQueueRead(tid, addr, 1, pc);
+		else
+			raceCheckRead8(tid, addr, pc);
+	}
 	return *((uint8_t *)addr);
 }
 
@@ -63,8 +82,13 @@ uint16_t load_16(const void *addr)
 {
 	DEBUG("addr = %p\n", addr);
 	thread_id_t tid = thread_current_id();
-	raceCheckRead(tid, addr);
-	raceCheckRead(tid, (const void *)(((uintptr_t)addr) + 1));
+	const void *pc = __builtin_return_address(0);
+	if (RACECHECKED(addr, pc)) {
+		if (raceAsync)
+			raceQueueRead(tid, addr, 2, pc);
+		else
+			raceCheckRead16(tid, addr, pc);
+	}
 	return *((uint16_t *)addr);
 }
 
@@ -72,10 +96,13 @@ uint32_t load_32(const void *addr)
 {
 	DEBUG("addr = %p\n", addr);
 	thread_id_t tid = thread_current_id();
-	raceCheckRead(tid, addr);
-	raceCheckRead(tid, (const void *)(((uintptr_t)addr) + 1));
-	raceCheckRead(tid, (const void *)(((uintptr_t)addr) + 2));
-	raceCheckRead(tid, (const void *)(((uintptr_t)addr) + 3));
+	const void *pc = __builtin_return_address(0);
+	if (RACECHECKED(addr, pc)) {
+		if (raceAsync)
+			raceQueueRead(tid, addr, 4, pc);
+		else
+			raceCheckRead32(tid, addr, pc);
+	}
 	return *((uint32_t *)addr);
 }
 
@@ -83,14 +110,13 @@ uint64_t load_64(const void *addr)
 {
 	DEBUG("addr = %p\n", addr);
 	thread_id_t tid = thread_current_id();
-	raceCheckRead(tid, addr);
-	raceCheckRead(tid, (const void *)(((uintptr_t)addr) + 1));
-	raceCheckRead(tid, (const void *)(((uintptr_t)addr) + 2));
-	raceCheckRead(tid, (const void *)(((uintptr_t)addr) + 3));
-	raceCheckRead(tid, (const void *)(((uintptr_t)addr) + 4));
-	raceCheckRead(tid, (const void *)(((uintptr_t)addr) + 5));
-	raceCheckRead(tid, (const void *)(((uintptr_t)addr) + 6));
-	raceCheckRead(tid, (const void *)(((uintptr_t)addr) + 7));
+	const void *pc = __builtin_return_address(0);
+	if (RACECHECKED(addr, pc)) {
+		if (raceAsync)
+			raceQueueRead(tid, addr, 8, pc);
+		else
+			raceCheckRead64(tid, addr, pc);
+	}
 	return *((uint64_t *)addr);
 }
 
@@ -107,7 +133,13 @@ void cds_store8(void *addr)
 	if (!model)
 		return;
 	thread_id_t tid = thread_current_id();
-	raceCheckWrite8(tid, addr);
+	const void *pc = __builtin_return_address(0);
+	if (RACECHECKED(addr, pc)) {
+		if (raceAsync)
+			raceQueueWrite(tid, addr, 1, pc);
+		else
+			raceCheckWrite8(tid, addr, pc);
+	}
 }
 
 void cds_store16(void *addr)
@@ -116,7 +148,13 @@ void cds_store16(void *addr)
 	if (!model)
 		return;
 	thread_id_t tid = thread_current_id();
-	raceCheckWrite16(tid, addr);
+	const void *pc = __builtin_return_address(0);
+	if (RACECHECKED(addr, pc)) {
+		if (raceAsync)
+			raceQueueWrite(tid, addr, 2, pc);
+		else
+			raceCheckWrite16(tid, addr, pc);
+	}
 }
 
 void cds_store32(void *addr)
@@ -125,7 +163,13 @@ void cds_store32(void *addr)
 	if (!model)
 		return;
 	thread_id_t tid = thread_current_id();
-	raceCheckWrite32(tid, addr);
+	const void *pc = __builtin_return_address(0);
+	if (RACECHECKED(addr, pc)) {
+		if (raceAsync)
+			raceQueueWrite(tid, addr, 4, pc);
+		else
+			raceCheckWrite32(tid, addr, pc);
+	}
 }
 
 void cds_store64(void *addr)
@@ -134,33 +178,94 @@ void cds_store64(void *addr)
 	if (!model)
 		return;
 	thread_id_t tid = thread_current_id();
-	raceCheckWrite64(tid, addr);
+	const void *pc = __builtin_return_address(0);
+	if (RACECHECKED(addr, pc)) {
+		if (raceAsync)
+			raceQueueWrite(tid, addr, 8, pc);
+		else
+			raceCheckWrite64(tid, addr, pc);
+	}
 }
 
 void cds_load8(const void *addr) {
 	if (!model)
 		return;
 	thread_id_t tid = thread_current_id();
-	raceCheckRead8(tid, addr);
+	const void *pc = __builtin_return_address(0);
+	if (RACECHECKED(addr, pc)) {
+		if (raceAsync)
+			raceQueueRead(tid, addr, 1, pc);
+		else
+			raceCheckRead8(tid, addr, pc);
+	}
 }
 
 void cds_load16(const void *addr) {
 	if (!model)
 		return;
 	thread_id_t tid = thread_current_id();
-	raceCheckRead16(tid, addr);
+	const void *pc = __builtin_return_address(0);
+	if (RACECHECKED(addr, pc)) {
+		if (raceAsync)
+			raceQueueRead(tid, addr, 2, pc);
+		else
+			raceCheckRead16(tid, addr, pc);
+	}
 }
 
 void cds_load32(const void *addr) {
 	if (!model)
 		return;
 	thread_id_t tid = thread_current_id();
-	raceCheckRead32(tid, addr);
+	const void *pc = __builtin_return_address(0);
+	if (RACECHECKED(addr, pc)) {
+		if (raceAsync)
+			raceQueueRead(tid, addr, 4, pc);
+		else
+			raceCheckRead32(tid, addr, pc);
+	}
 }
 
 void cds_load64(const void *addr) {
 	if (!model)
 		return;
 	thread_id_t tid = thread_current_id();
-	raceCheckRead64(tid, addr);
+	const void *pc = __builtin_return_address(0);
+	if (RACECHECKED(addr, pc)) {
+		if (raceAsync)
+			raceQueueRead(tid, addr, 8, pc);
+		else
+			raceCheckRead64(tid, addr, pc);
+	}
+}
+
+/**
+ * Bulk accesses such as memcpy, memmove and memset: the source is checked
+ * with cds_load_range and the destination with cds_store_range.
+ */
+
+void cds_load_range(const void *addr, size_t size) {
+	if (!model)
+		return;
+	thread_id_t tid = thread_current_id();
+	const void *pc = __builtin_return_address(0);
+	if (RACECHECKED(addr, pc)) {
+		if (raceAsync)
+			raceQueueRead(tid, addr, size, pc);
+		else
+			raceCheckReadRange(tid, addr, size, pc);
+	}
+}
+
+void cds_store_range(void *addr, size_t size) {
+	if (!model)
+		return;
+	thread_id_t tid = thread_current_id();
+	const void *pc = __builtin_return_address(0);
+	if (RACECHECKED(addr, pc)) {
+		if (raceAsync)
+			raceQueueWrite(tid, addr, size, pc);
+		else
+			raceCheckWriteRange(tid, addr, size, pc);
+	}
 }
@@ -25,6 +25,21 @@ void param_defaults(struct model_params *params)
 	params->checkthreshold = 500000;
 	params->removevisible = false;
 	params->nofork = false;
+	params->jobs = 1;
+	params->softdirty = false;
+	params->branch = 0;
+	params->sharedmem = 4096;
+	params->snapshotmem = 400;
+	params->hugepages = false;
+	params->flatshadow = false;
+	params->wideshadow = false;
+	params->asyncrace = false;
+	params->skipstack = false;
+	params->suppressions = NULL;
+	params->statsjson = NULL;
+	params->racesample = 1.0;
+	params->coldsitefull = false;
+	params->treeclocks = false;
 }
 
 static void print_usage(struct model_params *params)
@@ -42,26 +57,72 @@ static void print_usage(struct model_params *params)
 		"\n"
 		"MODEL-CHECKER OPTIONS can be any of the model-checker options listed below. Arguments\n"
 		"provided after the `--' (the PROGRAM ARGS) are passed to the user program.\n"
-		"\n"
+		"\n");
+	/* model_print() output is limited to 2048 bytes per call */
+	model_print(
 		"Model-checker options:\n"
 		"-h, --help                  Display this help message and exit\n"
 		"-v[NUM], --verbose[=NUM]    Print verbose execution information. NUM is optional:\n"
 		"                              0 is quiet; 1 shows valid executions; 2 is noisy;\n"
-		"                              3 is noisier.\n"
+		"                              3 is noisier, with race detector counters.\n"
 		"                              Default: %d\n"
 		"-t, --analysis=NAME         Use Analysis Plugin.\n"
 		"-o, --options=NAME          Option for previous analysis plugin.  \n"
 		"-x, --maxexec=NUM           Maximum number of executions.\n"
 		"                            Default: %u\n"
 		"                            -o help for a list of options\n"
-		"-n                          No fork\n"
+		"-n                          No fork: run every execution in-process; the\n"
+		"                            program resets itself with a reset hook.\n"
+		"-j, --jobs=NUM              Number of executions to run in parallel,\n"
+		"                            each in its own forked worker.\n"
+		"                            Default: %d\n"
+		"-s, --softdirty             Roll back executions in-process by restoring\n"
+		"                            the pages they dirtied, instead of forking.\n"
+		"                            Linux only.\n"
+		"-b, --branch=NUM            Snapshot executions at a deep decision point\n"
+		"                            and restart the next NUM executions there.\n"
+		"                            Default: %d\n",
+		params->verbose,
+		params->maxexecutions,
+		params->jobs,
+		params->branch);
+	model_print(
+		"-M, --sharedmem=MB          Address space to reserve for the model-checker's\n"
+		"                            shared heap; it is committed as it is used.\n"
+		"                            Default: %u\n"
+		"-S, --snapshotmem=MB        Initial size of the snapshotting heap, which\n"
+		"                            grows as needed.\n"
+		"                            Default: %u\n"
+		"-H, --hugepages             Back the snapshotting heap and race detector\n"
+		"                            tables with transparent huge pages.\n"
+		"-F, --flatshadow            Keep race detector shadow memory in one flat\n"
+		"                            region instead of lazily built tables.\n"
+		"-W, --wideshadow            Use 128-bit race detector shadow cells, which\n"
+		"                            stay compact past 62 threads or 2^25 clocks.\n"
+		"-A, --async-race            Race check plain loads and stores on a helper\n"
+		"                            thread; races are reported with only the\n"
+		"                            access site.\n"
+		"-P, --skip-stack            Skip race checks of plain accesses to the\n"
+		"                            running thread's own stack.\n"
+		"-X, --suppressions=FILE     Skip race checks of plain accesses made by\n"
+		"                            the code that FILE lists.\n"
+		"-J, --stats-json=FILE       Write the final stats, race detector counters\n"
+		"                            included, to FILE as JSON.\n"
+		"-R, --race-sample=RATE      Sample race checks per call site; hot sites\n"
+		"                            that never raced decay to checking RATE of\n"
+		"                            their accesses.\n"
+		"-C, --cold-site-full        With -R, check the first accesses of every\n"
+		"                            site in each execution.\n",
+		params->sharedmem,
+		params->snapshotmem);
+	model_print(
+		"-T, --tree-clocks           Use tree clocks, whose joins only visit the\n"
+		"                            threads whose clocks change.\n"
 		"-m, --minsize=NUM           Minimum number of actions to keep\n"
 		"                            Default: %u\n"
 		"-f, --freqfree=NUM          Frequency to free actions\n"
 		"                            Default: %u\n"
 		"-r, --removevisible         Free visible writes\n",
-		params->verbose,
-		params->maxexecutions,
 		params->traceminsize,
 		params->checkthreshold);
 	model_print("Analysis plugins:\n");
@@ -87,8 +148,15 @@ bool install_plugin(char * name) {
 	return true;
 }
 
-void parse_options(struct model_params *params) {
-	const char *shortopts = "hrnt:o:x:v:m:f:";
+/**
+ * @brief Parse the C11TESTER options
+ * @param params The parameters to fill in
+ * @param memoryonly Only look at the heap options, which are needed
+ * before the model-checker (and its plugins) can be created; leave the rest
+ * and any errors to the full pass
+ */
+static void parse_args(struct model_params *params, bool memoryonly) {
+	const char *shortopts = "hrnsHFWAPCTR:X:J:t:o:x:v:m:f:j:b:M:S:";
 	const struct option longopts[] = {
 		{"help", no_argument, NULL, 'h'},
 		{"removevisible", no_argument, NULL, 'r'},
@@ -98,6 +166,21 @@ void parse_options(struct model_params *params) {
 		{"verbose", optional_argument, NULL, 'v'},
 		{"minsize", required_argument, NULL, 'm'},
 		{"freqfree", required_argument, NULL, 'f'},
+		{"jobs", required_argument, NULL, 'j'},
+		{"softdirty", no_argument, NULL, 's'},
+		{"branch", required_argument, NULL, 'b'},
+		{"sharedmem", required_argument, NULL, 'M'},
+		{"snapshotmem", required_argument, NULL, 'S'},
+		{"hugepages", no_argument, NULL, 'H'},
+		{"flatshadow", no_argument, NULL, 'F'},
+		{"wideshadow", no_argument, NULL, 'W'},
+		{"async-race", no_argument, NULL, 'A'},
+		{"skip-stack", no_argument, NULL, 'P'},
+		{"suppressions", required_argument, NULL, 'X'},
+		{"stats-json", required_argument, NULL, 'J'},
+		{"race-sample", required_argument, NULL, 'R'},
+		{"cold-site-full", no_argument, NULL, 'C'},
+		{"tree-clocks", no_argument, NULL, 'T'},
 		{0, 0, 0, 0}	/* Terminator */
 	};
 	int opt, longindex;
@@ -126,13 +209,28 @@ void parse_options(struct model_params *params) {
 		}
 	}
 
+	if (memoryonly)
+		opterr = 0;
 	while (!error && (opt = getopt_long(argc, argv, shortopts, longopts, &longindex)) != -1) {
+		if (memoryonly && opt != 'M' && opt != 'S' && opt != 'H')
+			continue;
 		switch (opt) {
 		case 'h':
 			print_usage(params);
 			break;
 		case 'n':
+#if !defined(MAC)
 			params->nofork = true;
+#else
+			model_print("No-fork mode (-n) needs glibc; forking instead\n");
+#endif
+			break;
+		case 's':
+#if !defined(MAC)
+			params->softdirty = true;
+#else
+			model_print("In-process snapshots (-s) need Linux; forking instead\n");
+#endif
 			break;
 		case 'x':
 			params->maxexecutions = atoi(optarg);
@@ -153,6 +251,61 @@ void parse_options(struct model_params *params) {
 		case 'r':
 			params->removevisible = true;
 			break;
+		case 'j':
+			params->jobs = atoi(optarg);
+			if (params->jobs < 1)
+				error = true;
+			break;
+		case 'b':
+			params->branch = atoi(optarg);
+			if (params->branch < 0)
+				error = true;
+			break;
+		case 'M':
+			if (atoi(optarg) < 1)
+				error = true;
+			else
+				params->sharedmem = atoi(optarg);
+			break;
+		case 'S':
+			if (atoi(optarg) < 1)
+				error = true;
+			else
+				params->snapshotmem = atoi(optarg);
+			break;
+		case 'H':
+			params->hugepages = true;
+			break;
+		case 'F':
+			params->flatshadow = true;
+			break;
+		case 'W':
+			params->wideshadow = true;
+			break;
+		case 'A':
+			params->asyncrace = true;
+			break;
+		case 'P':
+			params->skipstack = true;
+			break;
+		case 'X':
+			/* optarg points into a copy of the options on our stack */
+			params->suppressions = strcpy((char *)model_malloc(strlen(optarg) + 1), optarg);
+			break;
+		case 'J':
+			params->statsjson = strcpy((char *)model_malloc(strlen(optarg) + 1), optarg);
+			break;
+		case 'R':
+			params->racesample = atof(optarg);
+			if (params->racesample <= 0 || params->racesample > 1)
+				error = true;
+			break;
+		case 'C':
+			params->coldsitefull = true;
+			break;
+		case 'T':
+			params->treeclocks = true;
+			break;
 		case 'o':
 		{
 			ModelVector<TraceAnalysis *> * analyses = getInstalledTraceAnalysis();
@@ -168,11 +321,20 @@ void parse_options(struct model_params *params) {
 
 	/* Special value to reset implementation as described by Linux man page.  */
 	optind = 0;
+	opterr = 1;
 
-	if (error)
+	if (error && !memoryonly)
 		print_usage(params);
 }
 
+void parse_memory_options(struct model_params *params) {
+	parse_args(params, true);
+}
+
+void parse_options(struct model_params *params) {
+	parse_args(params, false);
+}
+
 void install_trace_analyses(ModelExecution *execution) {
 	ModelVector<TraceAnalysis *> * installedanalysis=getInstalledTraceAnalysis();
 	for(unsigned int i=0;i<installedanalysis->size();i++) {
@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <inttypes.h>
+#include <sys/resource.h>
 #include <algorithm>
 #include <new>
 #include <stdarg.h>
@@ -11,6 +13,7 @@
 #include "snapshot-interface.h"
 #include "common.h"
 #include "datarace.h"
+#include "clockvector.h"
 #include "threads-model.h"
 #include "output.h"
 #include "traceanalysis.h"
@@ -28,6 +31,11 @@ void placeholder(void *) {
 
 #include <signal.h>
 
+#ifdef TLS
+/** Where the process's stack started, from the dynamic loader */
+extern "C" void *__libc_stack_end;
+#endif
+
 #define SIGSTACKSIZE 65536
 static void mprot_handle_pf(int sig, siginfo_t *si, void *unused)
 {
@@ -35,6 +43,7 @@ static void mprot_handle_pf(int sig, siginfo_t *si, void *unused)
 	model_print("For debugging, place breakpoint at: %s:%d\n",
 							__FILE__, __LINE__);
 	print_trace();	// Trace printing may cause dynamic memory allocation
+	printRaces();
 	while(1)
 		;
 }
@@ -58,7 +67,10 @@ void install_handler() {
 
 void createModelIfNotExist() {
 	if (!model) {
-		snapshot_system_init(100000);
+		struct model_params memparams;
+		param_defaults(&memparams);
+		parse_memory_options(&memparams);
+		snapshot_system_init(&memparams);
 		model = new ModelChecker();
 		model->startChecker();
 	}
@@ -72,6 +84,11 @@ ModelChecker::ModelChecker() :
 	history(new ModelHistory()),
 	execution(new ModelExecution(this, scheduler)),
 	execution_number(1),
+	checkpoint_warned(false),
+	branch_left(0),
+	decisions(0),
+	branch_at(0),
+	reset_hook(NULL),
 	curr_thread_num(1),
 	trace_analyses(),
 	inspect_plugin(NULL)
@@ -81,17 +98,13 @@ ModelChecker::ModelChecker() :
 							"Distributed under the GPLv2\n"
 							"Written by Weiyu Luo, Brian Norris, and Brian Demsky\n\n");
 	memset(&stats,0,sizeof(struct execution_stats));
-	init_thread = new Thread(execution->get_next_id(), (thrd_t *) model_malloc(sizeof(thrd_t)), &placeholder, NULL, NULL);
-#ifdef TLS
-	init_thread->setTLS((char *)get_tls_addr());
-#endif
-	execution->add_thread(init_thread);
-	scheduler->set_current_thread(init_thread);
+	add_init_thread();
 	register_plugins();
 	execution->setParams(&params);
 	param_defaults(&params);
 	parse_options(&params);
-	initRaceDetector();
+	initClockVectors(&params);
+	initRaceDetector(&params);
 	/* Configure output redirection for the model-checker */
 	install_handler();
 }
@@ -102,6 +115,26 @@ ModelChecker::~ModelChecker()
 	delete scheduler;
 }
 
+/** @brief Create the Thread for the program's initial thread */
+void ModelChecker::add_init_thread()
+{
+	init_thread = new Thread(execution->get_next_id(), &init_thrd, &placeholder, NULL, NULL);
+#ifdef TLS
+	init_thread->setTLS((char *)get_tls_addr());
+	/* The initial thread runs on the process's own stack, which can grow
+	 * down from where it starts up to its resource limit */
+	struct rlimit limit;
+	size_t size = 8 * 1024 * 1024;
+	if (getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+		size = limit.rlim_cur;
+	uintptr_t top = ((uintptr_t)__libc_stack_end + PAGESIZE - 1) & ~(uintptr_t)(PAGESIZE - 1);
+	init_thread->helper_pstack = (void *)(top - size);
+	init_thread->helper_pstack_size = size;
+#endif
+	execution->add_thread(init_thread);
+	scheduler->set_current_thread(init_thread);
+}
+
 /** Method to set parameters */
 model_params * ModelChecker::getParams() {
 	return &params;
@@ -122,6 +155,17 @@ void ModelChecker::reset_to_initial_state()
 	for (unsigned int i = 0;i < get_num_threads();i++)
 		delete get_thread(int_to_id(i))->get_pending();
 
+	if (branch_left > 0) {
+		branch_left--;
+		snapshot_roll_back(branch_snapshot);
+	}
+
+	/* Branch the next execution somewhere in the later half of this one */
+	if (params.branch && !params.nofork && !params.softdirty && decisions > 1)
+		branch_at = decisions / 2 + 1 + random() % (decisions - decisions / 2);
+	else
+		branch_at = 0;
+	decisions = 0;
 	snapshot_roll_back(snapshot);
 }
 
@@ -231,10 +275,32 @@ void ModelChecker::print_bugs() const
  */
 void ModelChecker::record_stats()
 {
+	size_t shared = shared_heap_peak();
+	size_t snap = snapshot_heap_peak();
+	if (shared > stats.shared_peak)
+		stats.shared_peak = shared;
+	if (snap > stats.snapshot_peak)
+		stats.snapshot_peak = snap;
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	if (usage.ru_maxrss > stats.peak_rss)
+		stats.peak_rss = usage.ru_maxrss;
+	stats.num_actions += execution->get_curr_seq_num();
+	stats.race = *getRaceStats();
+	uint64_t latency;
+	long faults;
+	if (snapshot_fork_cost(&latency, &faults)) {
+		stats.num_forked ++;
+		stats.fork_latency += latency;
+		stats.fork_faults += faults;
+	}
 	stats.num_total ++;
-	if (execution->have_bug_reports())
+	if (execution->have_bug_reports()) {
 		stats.num_buggy_executions ++;
-	else if (execution->is_complete_execution())
+		SnapVector<bug_message *> *bugs = execution->get_bugs();
+		for (unsigned int i = 0;i < bugs->size();i++)
+			snapshot_farm_add_bug((*bugs)[i]->msg);
+	} else if (execution->is_complete_execution())
 		stats.num_complete ++;
 	else {
 		//All threads are sleeping
@@ -253,6 +319,62 @@ void ModelChecker::print_stats() const
 	model_print("Number of complete, bug-free executions: %d\n", stats.num_complete);
 	model_print("Number of buggy executions: %d\n", stats.num_buggy_executions);
 	model_print("Total executions: %d\n", stats.num_total);
+	model_print("Total actions: %" PRIu64 "\n", stats.num_actions);
+	model_print("Peak RSS: %ld KB\n", stats.peak_rss);
+	model_print("Shared heap high-water mark: %zu KB of %u MB reserved\n", stats.shared_peak >> 10, params.sharedmem);
+	model_print("Snapshot heap high-water mark: %zu KB\n", stats.snapshot_peak >> 10);
+	if (stats.num_forked > 0)
+		model_print("Average fork latency: %" PRIu64 " us, %" PRIu64 " page faults per execution\n",
+								stats.fork_latency / stats.num_forked / 1000, stats.fork_faults / stats.num_forked);
+	if (params.verbose >= 3) {
+		const struct race_stats *race = &stats.race;
+		model_print("Race checks: %" PRIu64 " compact, %" PRIu64 " full\n", race->compact_checks, race->full_checks);
+		model_print("Race records: %" PRIu64 " expanded, %" PRIu64 " read set growths, %" PRIu64 " split granules\n",
+								race->expansions, race->read_growths, race->split_granules);
+		model_print("Shadow tables: %" PRIu64 " allocated, %" PRIu64 " KB\n", race->shadow_tables, race->shadow_bytes >> 10);
+		model_print("Races: %" PRIu64 " found, %" PRIu64 " filtered before unwinding, %" PRIu64 " rejected as duplicates\n",
+								race->races_found, race->races_filtered, race->races_rejected);
+	}
+}
+
+/** @brief Write the final stats as JSON to the file given with -J */
+void ModelChecker::write_stats_json() const
+{
+	if (params.statsjson == NULL)
+		return;
+	FILE *file = fopen(params.statsjson, "w");
+	if (file == NULL) {
+		perror(params.statsjson);
+		return;
+	}
+	const struct race_stats *race = &stats.race;
+	fprintf(file, "{\n"
+					"  \"executions\": %d,\n"
+					"  \"complete_executions\": %d,\n"
+					"  \"buggy_executions\": %d,\n"
+					"  \"actions\": %" PRIu64 ",\n"
+					"  \"peak_rss_kb\": %ld,\n"
+					"  \"shared_peak_bytes\": %zu,\n"
+					"  \"snapshot_peak_bytes\": %zu,\n"
+					"  \"race\": {\n"
+					"    \"compact_checks\": %" PRIu64 ",\n"
+					"    \"full_checks\": %" PRIu64 ",\n"
+					"    \"expansions\": %" PRIu64 ",\n"
+					"    \"read_growths\": %" PRIu64 ",\n"
+					"    \"split_granules\": %" PRIu64 ",\n"
+					"    \"shadow_tables\": %" PRIu64 ",\n"
+					"    \"shadow_bytes\": %" PRIu64 ",\n"
+					"    \"races_found\": %" PRIu64 ",\n"
+					"    \"races_filtered\": %" PRIu64 ",\n"
+					"    \"races_rejected\": %" PRIu64 "\n"
+					"  }\n"
+					"}\n",
+					stats.num_total, stats.num_complete, stats.num_buggy_executions, stats.num_actions,
+					stats.peak_rss, stats.shared_peak, stats.snapshot_peak,
+					race->compact_checks, race->full_checks, race->expansions, race->read_growths,
+					race->split_granules, race->shadow_tables, race->shadow_bytes,
+					race->races_found, race->races_filtered, race->races_rejected);
+	fclose(file);
 }
 
 /**
@@ -302,6 +424,9 @@ void ModelChecker::finish_execution(bool more_executions)
 	}
 
 	record_stats();
+	/* A buggy run may be cut short, so print the races found so far */
+	if (complete && execution->have_bug_reports())
+		printRaces();
 	/* Output */
 	if ( (complete && params.verbose) || params.verbose>1 || (complete && execution->have_bug_reports()))
 		print_execution(complete);
@@ -424,8 +549,12 @@ void ModelChecker::finishRunExecution(Thread *old)
 
 
 	/** We finished the final execution.  Print stuff and exit. */
-	model_print("******* Model-checking complete: *******\n");
-	print_stats();
+	printRaces();
+	if (!snapshot_farm_stats(&stats)) {
+		model_print("******* Model-checking complete: *******\n");
+		print_stats();
+		write_stats_json();
+	}
 
 	/* Have the trace analyses dump their output. */
 	for (unsigned int i = 0;i < trace_analyses.size();i++)
@@ -453,6 +582,8 @@ uint64_t ModelChecker::switch_thread(ModelAction *act)
 		return 0;
 	}
 	DBG();
+	/* Queued race checks must see the clocks from before this action */
+	RACEQUIESCE();
 	Thread *old = thread_current();
 	old->set_state(THREAD_READY);
 
@@ -531,6 +662,180 @@ void ModelChecker::startChecker() {
 	initMainThread();
 }
 
+/**
+ * @brief Move the point each execution restarts from to the caller
+ *
+ * Lets a test keep its expensive single-threaded setup out of every
+ * execution. Helper threads do not survive a fork, so the checkpoint is
+ * only honoured while the initial thread is the only user thread.
+ */
+void ModelChecker::checkpoint()
+{
+	/* No-fork mode rebuilds the model-checker from scratch each time */
+	if (params.nofork) {
+		if (!checkpoint_warned) {
+			model_print("Ignoring checkpoint in no-fork mode\n");
+			checkpoint_warned = true;
+		}
+		return;
+	}
+	/* No thread may have been created after the initial one */
+	if (int_to_id(get_num_threads() - 1) != init_thread->get_id() ||
+			thread_current() != init_thread) {
+		if (!checkpoint_warned) {
+			model_print("Ignoring checkpoint taken after threads were created\n");
+			checkpoint_warned = true;
+		}
+		return;
+	}
+	/* The snapshot loop's old context has already run, so start a new one */
+	RACEQUIESCE();
+	startExecution();
+	snapshot = take_snapshot();
+}
+
+/**
+ * @brief Tear down the current execution before the snapshot heap is thrown
+ * away
+ *
+ * Used by no-fork mode, which resets the model-checker in place instead of
+ * rolling back to a forked snapshot. Lets the real threads behind this
+ * execution's user threads exit and runs the user's reset hook.
+ */
+void ModelChecker::release_execution()
+{
+#ifdef TLS
+	/* Threads must exit without reporting THREAD_FINISH again */
+	real_init_all();
+	real_pthread_key_delete(execution->getPthreadKey());
+	set_tls_addr((uintptr_t)init_thread->tls);
+#endif
+	for (unsigned int i = 0;i < get_num_threads();i++) {
+		Thread *t = get_thread(int_to_id(i));
+		if (!t->is_model_thread() && !t->is_freed())
+			t->freeResources();
+	}
+	restore_output();
+	if (reset_hook)
+		reset_hook();
+}
+
+/**
+ * @brief Recreate the per-execution state in a fresh snapshot heap
+ * @see release_execution
+ */
+void ModelChecker::reset_execution()
+{
+	scheduler = new Scheduler();
+	execution = new ModelExecution(this, scheduler);
+	add_init_thread();
+	execution->setParams(&params);
+	resetClockVectors();
+	resetRaceDetector();
+}
+
+/**
+ * @brief Note that the current execution reached a scheduling or
+ * reads-from decision
+ *
+ * With branching enabled, an execution restarted from the initial snapshot
+ * takes a branch snapshot at a deep decision point, and the next
+ * params.branch executions restart from there to explore other suffixes
+ * without replaying the shared prefix.
+ */
+void ModelChecker::branch_point()
+{
+	if (++decisions != branch_at || branch_left > 0)
+		return;
+
+	/* These fields live in shared memory, so carry their values at the
+	 * branch point over to every execution restarted from it */
+	Thread *chosen = chosen_thread;
+	unsigned int threadnum = curr_thread_num;
+	modelclock_t freeclock = checkfree;
+	bool brk = break_execution;
+
+	branch_left = params.branch;
+	startExecution();
+	branch_snapshot = take_snapshot();
+
+	chosen_thread = chosen;
+	curr_thread_num = threadnum;
+	checkfree = freeclock;
+	break_execution = brk;
+	decisions = branch_at;
+}
+
+/**
+ * @brief Set up this process as one worker of a fork farm
+ *
+ * Gives the worker its share of the executions and a random seed derived
+ * from its index, so that workers explore different executions.
+ * @param worker The index of this worker
+ * @param jobs The number of workers in the farm
+ */
+void ModelChecker::set_worker(int worker, int jobs)
+{
+	int executions = params.maxexecutions;
+	params.maxexecutions = executions / jobs + (worker < executions % jobs ? 1 : 0);
+	initstate(423121 + worker, random_state, sizeof(random_state));
+}
+
+/** @brief Add the race detector counters of a worker to a total */
+static void add_race_stats(struct race_stats *total, const struct race_stats *race)
+{
+	total->compact_checks += race->compact_checks;
+	total->full_checks += race->full_checks;
+	total->expansions += race->expansions;
+	total->read_growths += race->read_growths;
+	total->split_granules += race->split_granules;
+	total->shadow_tables += race->shadow_tables;
+	total->shadow_bytes += race->shadow_bytes;
+	total->races_found += race->races_found;
+	total->races_filtered += race->races_filtered;
+	total->races_rejected += race->races_rejected;
+}
+
+/**
+ * @brief Merge and print the stats and bugs of all workers of a fork farm
+ * @param workerstats The final stats of each worker
+ * @param jobs The number of workers in the farm
+ * @param bugs The distinct bug messages of the workers, each ending in a
+ * null character
+ * @param bugbytes The length of @a bugs
+ * @param droppedbugs The number of distinct bug messages left out of @a bugs
+ */
+void ModelChecker::finish_farm(const struct execution_stats *workerstats, int jobs, const char *bugs, size_t bugbytes, unsigned int droppedbugs)
+{
+	memset(&stats, 0, sizeof(struct execution_stats));
+	for (int i = 0;i < jobs;i++) {
+		stats.num_total += workerstats[i].num_total;
+		stats.num_buggy_executions += workerstats[i].num_buggy_executions;
+		stats.num_complete += workerstats[i].num_complete;
+		stats.num_actions += workerstats[i].num_actions;
+		if (workerstats[i].peak_rss > stats.peak_rss)
+			stats.peak_rss = workerstats[i].peak_rss;
+		if (workerstats[i].shared_peak > stats.shared_peak)
+			stats.shared_peak = workerstats[i].shared_peak;
+		if (workerstats[i].snapshot_peak > stats.snapshot_peak)
+			stats.snapshot_peak = workerstats[i].snapshot_peak;
+		stats.num_forked += workerstats[i].num_forked;
+		stats.fork_latency += workerstats[i].fork_latency;
+		stats.fork_faults += workerstats[i].fork_faults;
+		add_race_stats(&stats.race, &workerstats[i].race);
+	}
+	model_print("******* Model-checking complete (%d workers): *******\n", jobs);
+	if (bugbytes > 0) {
+		model_print("Bugs found by the workers:\n");
+		for (size_t pos = 0;pos < bugbytes;pos += strlen(&bugs[pos]) + 1)
+			model_print("%s", &bugs[pos]);
+		if (droppedbugs > 0)
+			model_print("  ... and %u more\n", droppedbugs);
+	}
+	print_stats();
+	write_stats_json();
+}
+
 bool ModelChecker::should_terminate_execution()
 {
 	if (execution->have_bug_reports()) {
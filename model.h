@@ -15,14 +15,24 @@
 #include "stl-model.h"
 #include "context.h"
 #include "params.h"
+#include "threads.h"
 #include "classlist.h"
 #include "snapshot-interface.h"
+#include "datarace.h"
 
 /** @brief Model checker execution stats */
 struct execution_stats {
 	int num_total;	/**< @brief Total number of executions */
 	int num_buggy_executions;	/** @brief Number of buggy executions */
 	int num_complete;	/**< @brief Number of feasible, non-buggy, complete executions */
+	uint64_t num_actions;	/**< @brief Total number of actions run by all executions */
+	long peak_rss;	/**< @brief Largest resident set of an execution's process, in KB */
+	size_t shared_peak;	/**< @brief Most shared heap ever in use */
+	size_t snapshot_peak;	/**< @brief Most snapshotting heap in use during an execution */
+	int num_forked;	/**< @brief Number of executions that ran in a forked process */
+	uint64_t fork_latency;	/**< @brief Total nanoseconds spent forking those processes */
+	uint64_t fork_faults;	/**< @brief Total page faults taken by those processes */
+	struct race_stats race;	/**< @brief Race detector counters */
 };
 
 /** @brief The central structure for model-checking */
@@ -56,6 +66,13 @@ public:
 	void add_trace_analysis(TraceAnalysis *a) {     trace_analyses.push_back(a); }
 	void set_inspect_plugin(TraceAnalysis *a) {     inspect_plugin=a;       }
 	void startChecker();
+	void checkpoint();
+	void branch_point();
+	void release_execution();
+	void reset_execution();
+	void set_reset_hook(VoidFuncPtr hook) { reset_hook = hook; }
+	void set_worker(int worker, int jobs);
+	void finish_farm(const struct execution_stats *workerstats, int jobs, const char *bugs, size_t bugbytes, unsigned int droppedbugs);
 	Thread * getInitThread() {return init_thread;}
 	Scheduler * getScheduler() {return scheduler;}
 	MEMALLOC
@@ -64,13 +81,32 @@ private:
 	snapshot_id snapshot;
 
 	/** The scheduler to use: tracks the running/ready Threads */
-	Scheduler * const scheduler;
+	Scheduler * scheduler;
 	ModelHistory * history;
 	ModelExecution *execution;
 	Thread * init_thread;
 
 	int execution_number;
 
+	/** Whether an ignored checkpoint has already been reported */
+	bool checkpoint_warned;
+
+	/** Snapshot taken at a deep decision point of an earlier execution */
+	snapshot_id branch_snapshot;
+	/** Executions still to be restarted from branch_snapshot */
+	int branch_left;
+	/** Decision points reached so far in this execution */
+	unsigned int decisions;
+	/** Decision point at which to take the next branch snapshot */
+	unsigned int branch_at;
+
+	/** User function that resets the program between no-fork executions */
+	VoidFuncPtr reset_hook;
+
+	/** Handle of the program's initial thread */
+	thrd_t init_thrd;
+	void add_init_thread();
+
 	unsigned int curr_thread_num;
 	Thread * chosen_thread;
 	bool break_execution;
@@ -102,6 +138,7 @@ private:
 	void print_bugs() const;
 	void print_execution(bool printbugs) const;
 	void print_stats() const;
+	void write_stats_json() const;
 };
 
 extern ModelChecker *model;
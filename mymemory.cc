@@ -20,22 +20,97 @@ int nextRequest = 0;
 int howManyFreed = 0;
 mspace sStaticSpace = NULL;
 
+/** @brief The bytes a model-checker heap has in use, and the most it ever had */
+struct heap_usage {
+	size_t inuse;
+	size_t peak;
+};
+
+/** The shared heap's usage lives in the shared heap, so that every process
+ *  allocating from it keeps one count */
+static struct heap_usage *sharedUsage;
+/** The snapshotting heap's usage rolls back with the heap */
+static struct heap_usage snapshotUsage;
+
+/** @return The bytes the heap spends on an allocated block, counting its
+ *  chunk header as mallinfo does */
+static inline size_t chunk_bytes(void *ptr)
+{
+	return mspace_usable_size(ptr) + sizeof(size_t);
+}
+
+static inline void heap_usage_add(struct heap_usage *usage, void *ptr)
+{
+	usage->inuse += chunk_bytes(ptr);
+	if (usage->inuse > usage->peak)
+		usage->peak = usage->inuse;
+}
+
+static inline void heap_usage_sub(struct heap_usage *usage, void *ptr)
+{
+	usage->inuse -= chunk_bytes(ptr);
+}
+
+/** @brief Start counting the shared heap's use; call once it is created */
+void init_shared_heap_usage()
+{
+	sharedUsage = (struct heap_usage *)mspace_calloc(sStaticSpace, 1, sizeof(struct heap_usage));
+}
+
+/** @brief Forget the snapshotting heap's contents when it is recreated */
+void reset_snapshot_heap_usage()
+{
+	snapshotUsage.inuse = 0;
+}
+
+/** @return The most bytes the shared heap has had in use */
+size_t shared_heap_peak()
+{
+	return sharedUsage->peak;
+}
+
+/** @return The most bytes the snapshotting heap has had in use since the
+ *  snapshot this process runs from was taken, and before it */
+size_t snapshot_heap_peak()
+{
+	return snapshotUsage.peak;
+}
+
+/** @brief Fail loudly when the shared heap has used up its reserved region */
+static void * check_shared_alloc(void *ptr)
+{
+	if (!ptr) {
+		model_print("Out of shared memory; reserve more with -M\n");
+		exit(EXIT_FAILURE);
+	}
+	return ptr;
+}
+
 /** Non-snapshotting calloc for our use. */
 void *model_calloc(size_t count, size_t size)
 {
-	return mspace_calloc(sStaticSpace, count, size);
+	void *tmp = check_shared_alloc(mspace_calloc(sStaticSpace, count, size));
+	heap_usage_add(sharedUsage, tmp);
+	return tmp;
 }
 
 /** Non-snapshotting malloc for our use. */
 void *model_malloc(size_t size)
 {
-	return mspace_malloc(sStaticSpace, size);
+	void *tmp = check_shared_alloc(mspace_malloc(sStaticSpace, size));
+	heap_usage_add(sharedUsage, tmp);
+	return tmp;
 }
 
 /** Non-snapshotting malloc for our use. */
 void *model_realloc(void *ptr, size_t size)
 {
-	return mspace_realloc(sStaticSpace, ptr, size);
+	if (ptr)
+		heap_usage_sub(sharedUsage, ptr);
+	void *tmp = mspace_realloc(sStaticSpace, ptr, size);
+	if (tmp)
+		heap_usage_add(sharedUsage, tmp);
+	return size ? check_shared_alloc(tmp) : tmp;
 }
 
 /** @brief Snapshotting malloc, for use by model-checker (not user progs) */
@@ -43,6 +118,7 @@ void * snapshot_malloc(size_t size)
 {
 	void *tmp = mspace_malloc(model_snapshot_space, size);
 	ASSERT(tmp);
+	heap_usage_add(&snapshotUsage, tmp);
 	return tmp;
 }
 
@@ -51,26 +127,43 @@ void * snapshot_calloc(size_t count, size_t size)
 {
 	void *tmp = mspace_calloc(model_snapshot_space, count, size);
 	ASSERT(tmp);
+	heap_usage_add(&snapshotUsage, tmp);
 	return tmp;
 }
 
 /** @brief Snapshotting realloc, for use by model-checker (not user progs) */
 void *snapshot_realloc(void *ptr, size_t size)
 {
+	if (ptr)
+		heap_usage_sub(&snapshotUsage, ptr);
 	void *tmp = mspace_realloc(model_snapshot_space, ptr, size);
 	ASSERT(tmp);
+	heap_usage_add(&snapshotUsage, tmp);
+	return tmp;
+}
+
+/** @brief Snapshotting memalign, for use by model-checker (not user progs) */
+void * snapshot_memalign(size_t alignment, size_t size)
+{
+	void *tmp = mspace_memalign(model_snapshot_space, alignment, size);
+	ASSERT(tmp);
+	heap_usage_add(&snapshotUsage, tmp);
 	return tmp;
 }
 
 /** @brief Snapshotting free, for use by model-checker (not user progs) */
 void snapshot_free(void *ptr)
 {
+	if (ptr)
+		heap_usage_sub(&snapshotUsage, ptr);
 	mspace_free(model_snapshot_space, ptr);
 }
 
 /** Non-snapshotting free for our use. */
 void model_free(void *ptr)
 {
+	if (ptr)
+		heap_usage_sub(sharedUsage, ptr);
 	mspace_free(sStaticSpace, ptr);
 }
 
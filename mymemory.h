@@ -55,8 +55,14 @@ void * model_realloc(void *ptr, size_t size);
 void * snapshot_malloc(size_t size);
 void * snapshot_calloc(size_t count, size_t size);
 void * snapshot_realloc(void *ptr, size_t size);
+void * snapshot_memalign(size_t alignment, size_t size);
 void snapshot_free(void *ptr);
 
+void init_shared_heap_usage();
+void reset_snapshot_heap_usage();
+size_t shared_heap_peak();
+size_t snapshot_heap_peak();
+
 typedef void * mspace;
 extern mspace sStaticSpace;
 
@@ -255,8 +261,27 @@ extern void * mspace_malloc(mspace msp, size_t bytes);
 extern void mspace_free(mspace msp, void* mem);
 extern void * mspace_realloc(mspace msp, void* mem, size_t newsize);
 extern void * mspace_calloc(mspace msp, size_t n_elements, size_t elem_size);
+extern void * mspace_memalign(mspace msp, size_t alignment, size_t bytes);
 extern mspace create_mspace_with_base(void* base, size_t capacity, int locked);
 extern mspace create_mspace(size_t capacity, int locked);
+extern size_t destroy_mspace(mspace msp);
+extern size_t mspace_set_footprint_limit(mspace msp, size_t bytes);
+
+/** @brief Layout-compatible with dlmalloc's struct mallinfo (size_t fields) */
+struct mspace_stats {
+	size_t arena;	/**< @brief Bytes held in the mspace's segments */
+	size_t ordblks;
+	size_t smblks;
+	size_t hblks;
+	size_t hblkhd;
+	size_t usmblks;	/**< @brief Maximum footprint */
+	size_t fsmblks;
+	size_t uordblks;	/**< @brief Bytes currently allocated */
+	size_t fordblks;
+	size_t keepcost;	/**< @brief Size of the top (never touched) chunk */
+};
+extern struct mspace_stats mspace_mallinfo(mspace msp);
+extern size_t mspace_usable_size(void *mem);
 
 extern mspace model_snapshot_space;
 
@@ -11,10 +11,12 @@
 static inline void redirect_output() { }
 static inline void clear_program_output() { }
 static inline void print_program_output() { }
+static inline void restore_output() { }
 #else
 void redirect_output();
 void clear_program_output();
 void print_program_output();
+void restore_output();
 #endif	/* ! CONFIG_DEBUG */
 
 #endif	/* __OUTPUT_H__ */
@@ -12,10 +12,65 @@ struct model_params {
 	modelclock_t checkthreshold;
 	bool removevisible;
 
+	/** @brief Number of executions to run concurrently (fork farm) */
+	int jobs;
+
+	/** @brief Roll back in-process by restoring dirtied pages, instead of
+	 *  forking a child per execution */
+	bool softdirty;
+
+	/** @brief Number of executions restarted from each branch snapshot
+	 *  (0 disables branching) */
+	int branch;
+
+	/** @brief Megabytes of address space reserved for the shared heap */
+	unsigned int sharedmem;
+
+	/** @brief Initial size of the snapshotting heap in megabytes */
+	unsigned int snapshotmem;
+
+	/** @brief Back the snapshotting heap and shadow tables with transparent
+	 *  huge pages */
+	bool hugepages;
+
+	/** @brief Keep race detector shadow memory in one flat region */
+	bool flatshadow;
+
+	/** @brief Use two-word race detector shadow cells, which stay compact
+	 *  for larger thread ids and clocks */
+	bool wideshadow;
+
+	/** @brief Race check plain accesses on a helper thread */
+	bool asyncrace;
+
+	/** @brief Skip race checks of plain accesses to the running thread's
+	 *  own stack */
+	bool skipstack;
+
+	/** @brief File listing the code whose plain accesses are not race
+	 *  checked, or NULL */
+	const char *suppressions;
+
+	/** @brief File to write the final stats to as JSON, or NULL */
+	const char *statsjson;
+
+	/** @brief Lowest rate that sampled race checks decay to at hot call
+	 *  sites (1 checks every access) */
+	double racesample;
+
+	/** @brief With sampling, fully check the first accesses of each call
+	 *  site in every execution */
+	bool coldsitefull;
+
+	/** @brief Use tree clocks, whose joins only visit the threads whose
+	 *  clocks change, rather than flat clock vectors */
+	bool treeclocks;
+
 	/** @brief Verbosity (0 = quiet; 1 = noisy; 2 = noisier) */
 	int verbose;
 };
 
 void param_defaults(struct model_params *params);
+void parse_memory_options(struct model_params *params);
 
 #endif	/* __PARAMS_H__ */
@@ -61,6 +61,7 @@ void pthread_exit(void *value_ptr) {
 
 int pthread_mutex_init(pthread_mutex_t *p_mutex, const pthread_mutexattr_t * attr) {
 	createModelIfNotExist();
+	RACEQUIESCE();
 	int mutex_type = PTHREAD_MUTEX_DEFAULT;
 	if (attr != NULL)
 		pthread_mutexattr_gettype(attr, &mutex_type);
@@ -150,6 +151,7 @@ int pthread_key_delete(pthread_key_t) {
 }
 
 int pthread_cond_init(pthread_cond_t *p_cond, const pthread_condattr_t *attr) {
+	RACEQUIESCE();
 	cdsc::snapcondition_variable *v = new cdsc::snapcondition_variable();
 
 	ModelExecution *execution = model->get_execution();
@@ -215,6 +217,7 @@ int pthread_cond_broadcast(pthread_cond_t *p_cond) {
 }
 
 int pthread_cond_destroy(pthread_cond_t *p_cond) {
+	RACEQUIESCE();
 	ModelExecution *execution = model->get_execution();
 
 	if (execution->getCondMap()->contains(p_cond)) {
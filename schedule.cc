@@ -223,6 +223,8 @@ Thread * Scheduler::select_next_thread()
 	if (avail_threads == 0 && !execution->getFuzzer()->has_paused_threads()) {
 		if (sleep_threads != 0) {
 			// No threads available, but some threads sleeping. Wake up one of them
+			if (sleep_threads > 1)
+				model->branch_point();
 			thread = execution->getFuzzer()->selectThread(sleep_list, sleep_threads);
 			remove_sleep(thread);
 			thread->set_wakeup_state(true);
@@ -231,6 +233,8 @@ Thread * Scheduler::select_next_thread()
 		}
 	} else {
 		// Some threads are available
+		if (avail_threads > 1)
+			model->branch_point();
 		thread = execution->getFuzzer()->selectThread(thread_list, avail_threads);
 	}
 
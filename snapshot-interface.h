@@ -5,15 +5,24 @@
 
 #ifndef __SNAPINTERFACE_H
 #define __SNAPINTERFACE_H
+#include <stddef.h>
+#include <stdint.h>
 #include <ucontext.h>
 
 typedef unsigned int snapshot_id;
 typedef void (*VoidFuncPtr)();
 
-void snapshot_system_init(unsigned int numheappages);
+struct model_params;
+void snapshot_system_init(const struct model_params *params);
 void startExecution();
 snapshot_id take_snapshot();
 void snapshot_roll_back(snapshot_id theSnapShot);
 
+struct execution_stats;
+bool snapshot_farm_stats(const struct execution_stats *stats);
+bool snapshot_farm_add_race(unsigned int hash);
+void snapshot_farm_add_bug(const char *msg);
+bool snapshot_fork_cost(uint64_t *latency, long *faults);
+
 
 #endif
@@ -6,6 +6,15 @@
 #include <string.h>
 #include <errno.h>
 #include <sys/wait.h>
+#include <time.h>
+#include <sys/resource.h>
+#if !defined(MAC)
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sched.h>
+#include <asm/prctl.h>
+#endif
 
 #include "hashtable.h"
 #include "snapshot.h"
@@ -13,16 +22,20 @@
 #include "common.h"
 #include "context.h"
 #include "model.h"
+#include "params.h"
 
 
-#define SHARED_MEMORY_DEFAULT  (200 * ((size_t)1 << 20))	// 100mb for the shared memory
-#define STACK_SIZE_DEFAULT      (((size_t)1 << 20) * 20)	// 20 mb out of the above 100 mb for my stack
+#define STACK_SIZE_DEFAULT      (((size_t)1 << 20) * 20)	// 20 mb for my stack
 
 struct fork_snapshotter {
 	/** @brief Pointer to the shared (non-snapshot) memory heap base
-	 * (NOTE: this has size SHARED_MEMORY_DEFAULT - sizeof(*fork_snap)) */
+	 * (NOTE: this has size mSharedMemorySize - sizeof(*fork_snap)) */
 	void *mSharedMemoryBase;
 
+	/** @brief Size of the shared region reserved for the heap. Pages are
+	 *  only committed when the heap first touches them. */
+	size_t mSharedMemorySize;
+
 	/** @brief Pointer to the shared (non-snapshot) stack region */
 	void *mStackBase;
 
@@ -44,11 +57,53 @@ struct fork_snapshotter {
 
 	/** @brief Inter-process tracking of the next snapshot ID */
 	snapshot_id currSnapShotID;
+
+	/** @brief Initial size of the snapshotting heap */
+	size_t mSnapshotHeapSize;
+
+	/** @brief Back the snapshotting heap with transparent huge pages */
+	bool mHugePages;
 };
 
 static struct fork_snapshotter *fork_snap = NULL;
 ucontext_t shared_ctxt;
 
+/** Maximum number of concurrent workers in a fork farm */
+#define MAX_FARM_JOBS 256
+/** Number of slots in the farm's table of reported races */
+#define FARM_RACE_SLOTS 16384
+/** Bytes of bug messages the farm keeps for its summary */
+#define FARM_BUG_BYTES 65536
+
+/**
+ * @brief Record shared by all the workers of a fork farm (-j)
+ *
+ * Each worker privatizes its copy of the fork_snapshotter region, so anything
+ * that has to be merged across workers lives here instead.
+ */
+struct fork_farm {
+	/** @brief The final execution stats of each worker */
+	struct execution_stats stats[MAX_FARM_JOBS];
+
+	/** @brief Open-addressed set of race hashes (0 marks an empty slot) */
+	volatile unsigned int races[FARM_RACE_SLOTS];
+
+	/** @brief The distinct bug messages of all workers, each ending in a
+	 *  null character */
+	char bugs[FARM_BUG_BYTES];
+	size_t bugbytes;
+
+	/** @brief Distinct bug messages there was no room for */
+	unsigned int droppedbugs;
+
+	/** @brief Held by the worker updating the bug messages */
+	volatile int buglock;
+};
+
+static struct fork_farm *fork_farm = NULL;
+/** @brief Index of this process' worker in the farm, or -1 */
+static int farm_worker = -1;
+
 /** @statics
  *   These variables are necessary because the stack is shared region and
  *   there exists a race between all processes executing the same function.
@@ -66,6 +121,11 @@ ucontext_t shared_ctxt;
 static ucontext_t private_ctxt;
 static snapshot_id snapshotid = 0;
 
+/** @brief When the fork that created this process started */
+static struct timespec fork_started;
+/** @brief Nanoseconds from the start of that fork until it returned here */
+static uint64_t fork_latency = 0;
+
 /**
  * @brief Create a new context, with a given stack and entry function
  * @param ctxt The context structure to fill
@@ -90,10 +150,11 @@ static void fork_exit()
 	_Exit(EXIT_SUCCESS);
 }
 
-static void createSharedMemory()
+static void createSharedMemory(size_t sharedsize)
 {
-	//step 1. create shared memory.
-	void *memMapBase = mmap(0, SHARED_MEMORY_DEFAULT + STACK_SIZE_DEFAULT, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+	//step 1. reserve shared memory; it is committed on demand.
+	sharedsize = (sharedsize + PAGESIZE - 1) & ~((size_t)PAGESIZE - 1);
+	void *memMapBase = mmap(0, sharedsize + STACK_SIZE_DEFAULT, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON | MAP_NORESERVE, -1, 0);
 	if (memMapBase == MAP_FAILED) {
 		perror("mmap");
 		exit(EXIT_FAILURE);
@@ -102,53 +163,308 @@ static void createSharedMemory()
 	//Setup snapshot record at top of free region
 	fork_snap = (struct fork_snapshotter *)memMapBase;
 	fork_snap->mSharedMemoryBase = (void *)((uintptr_t)memMapBase + sizeof(*fork_snap));
-	fork_snap->mStackBase = (void *)((uintptr_t)memMapBase + SHARED_MEMORY_DEFAULT);
+	fork_snap->mSharedMemorySize = sharedsize;
+	fork_snap->mStackBase = (void *)((uintptr_t)memMapBase + sharedsize);
 	fork_snap->mStackSize = STACK_SIZE_DEFAULT;
 	fork_snap->mIDToRollback = -1;
 	fork_snap->currSnapShotID = 0;
 	sStaticSpace = create_shared_mspace();
+	init_shared_heap_usage();
 }
 
 /**
  * Create a new mspace pointer for the non-snapshotting (i.e., inter-process
  * shared) memory region. Only for fork-based snapshotting.
  *
+ * The mspace never grows past the reserved region: dlmalloc would otherwise
+ * extend it with private mappings that are not shared across processes.
+ *
  * @return The shared memory mspace
  */
 mspace create_shared_mspace()
 {
-	if (!fork_snap)
-		createSharedMemory();
-	return create_mspace_with_base((void *)(fork_snap->mSharedMemoryBase), SHARED_MEMORY_DEFAULT - sizeof(*fork_snap), 1);
+	size_t capacity = fork_snap->mSharedMemorySize - sizeof(*fork_snap);
+	mspace space = create_mspace_with_base((void *)(fork_snap->mSharedMemoryBase), capacity, 1);
+	mspace_set_footprint_limit(space, capacity);
+	return space;
+}
+
+/**
+ * @brief Create the snapshotting heap
+ *
+ * The heap grows past its initial size as needed. With -H its initial region
+ * is aligned to and advised to be backed by transparent huge pages, so that
+ * each fork has far fewer page table entries to copy.
+ *
+ * @return The snapshotting mspace
+ */
+static mspace create_snapshot_mspace()
+{
+	if (!fork_snap->mHugePages)
+		return create_mspace(fork_snap->mSnapshotHeapSize, 1);
+
+	/* No-fork mode recreates the heap in the same region */
+	static char *base = NULL;
+	size_t size = (fork_snap->mSnapshotHeapSize + HUGEPAGESIZE - 1) & ~((size_t)HUGEPAGESIZE - 1);
+	if (!base) {
+		char *map = (char *)mmap(0, size + HUGEPAGESIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+		if (map == MAP_FAILED) {
+			perror("mmap");
+			exit(EXIT_FAILURE);
+		}
+		base = (char *)(((uintptr_t)map + HUGEPAGESIZE - 1) & ~((uintptr_t)HUGEPAGESIZE - 1));
+		if (base != map)
+			munmap(map, base - map);
+		munmap(base + size, map + HUGEPAGESIZE - base);
+		if (madvise(base, size, MADV_HUGEPAGE) != 0)
+			model_print("Transparent huge pages unavailable; using normal pages\n");
+	}
+	return create_mspace_with_base(base, size, 1);
 }
 
-static void fork_snapshot_init(unsigned int numheappages)
+static void fork_snapshot_init(const struct model_params *params)
 {
 	if (!fork_snap)
-		createSharedMemory();
+		createSharedMemory((size_t)params->sharedmem << 20);
+
+	fork_snap->mSnapshotHeapSize = (size_t)params->snapshotmem << 20;
+	fork_snap->mHugePages = params->hugepages;
+	model_snapshot_space = create_snapshot_mspace();
+}
+
+/**
+ * @brief Give this process its own copy of the shared memory region
+ *
+ * Workers of a fork farm start from the same model-checker state but must not
+ * see each other's updates to it. Only the part of the shared heap that is in
+ * use is copied; the rest of the region is fresh zero pages.
+ */
+static void privatizeSharedMemory()
+{
+	struct mspace_stats info = mspace_mallinfo(sStaticSpace);
+	size_t sharedsize = fork_snap->mSharedMemorySize;
+	size_t mapsize = sharedsize + STACK_SIZE_DEFAULT;
+	size_t used = ((uintptr_t)fork_snap->mSharedMemoryBase - (uintptr_t)fork_snap) + info.arena - info.keepcost + PAGESIZE;
+	if (used > sharedsize)
+		used = sharedsize;
+
+	void *copy = mmap(0, used, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (copy == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(copy, fork_snap, used);
+	void *base = mmap(fork_snap, mapsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON | MAP_NORESERVE | MAP_FIXED, -1, 0);
+	if (base == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(base, copy, used);
+	munmap(copy, used);
+}
+
+/**
+ * @brief Split the snapshot process into a farm of workers
+ *
+ * Forks @a jobs workers from the snapshot point. Each one runs its own
+ * fork loop over its share of the executions; this process waits for all of
+ * them and prints the merged stats. Only returns in the workers.
+ */
+static void fork_farm_workers(int jobs)
+{
+	if (jobs > MAX_FARM_JOBS)
+		jobs = MAX_FARM_JOBS;
+	if (jobs > model->params.maxexecutions)
+		jobs = model->params.maxexecutions;
+	/* A farm of one worker is just the usual fork loop */
+	if (jobs < 2)
+		return;
+
+	fork_farm = (struct fork_farm *)mmap(0, sizeof(struct fork_farm), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+	if (fork_farm == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+
+	for (int i = 0;i < jobs;i++) {
+		modellock = 1;
+		pid_t forkedID = fork();
+		modellock = 0;
+
+		if (forkedID < 0) {
+			perror("fork");
+			exit(EXIT_FAILURE);
+		} else if (forkedID == 0) {
+			privatizeSharedMemory();
+			farm_worker = i;
+			model->set_worker(i, jobs);
+			return;
+		}
+		DEBUG("farm PID: %d, worker %d PID: %d\n", getpid(), i, forkedID);
+	}
+
+	for (int i = 0;i < jobs;) {
+		if (wait(NULL) >= 0)
+			i++;
+		else if (errno != EINTR) {
+			perror("wait");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	model->finish_farm(fork_farm->stats, jobs, fork_farm->bugs, fork_farm->bugbytes, fork_farm->droppedbugs);
+	_Exit(EXIT_SUCCESS);
+}
+
+/**
+ * @brief Hand a worker's final execution stats to the farm
+ * @return False if this process is not part of a fork farm
+ */
+bool snapshot_farm_stats(const struct execution_stats *stats)
+{
+	if (farm_worker < 0)
+		return false;
+	fork_farm->stats[farm_worker] = *stats;
+	return true;
+}
+
+/**
+ * @brief Record a race in the set shared by all workers of a fork farm
+ * @param hash The hash of the race's backtrace
+ * @return True if no worker has reported this race yet
+ */
+bool snapshot_farm_add_race(unsigned int hash)
+{
+	if (farm_worker < 0)
+		return true;
+	if (hash == 0)
+		hash = 1;
+	for (unsigned int i = 0;i < FARM_RACE_SLOTS;i++) {
+		unsigned int index = (hash + i) % FARM_RACE_SLOTS;
+		unsigned int old = __sync_val_compare_and_swap(&fork_farm->races[index], 0, hash);
+		if (old == 0)
+			return true;
+		if (old == hash)
+			return false;
+	}
+	/* Table is full, so err on the side of reporting */
+	return true;
+}
 
-	model_snapshot_space = create_mspace(numheappages * PAGESIZE, 1);
+/**
+ * @brief Keep a bug message for the summary of a fork farm, unless a worker
+ * already reported the same one
+ * @param msg The bug message
+ */
+void snapshot_farm_add_bug(const char *msg)
+{
+	if (farm_worker < 0)
+		return;
+	size_t len = strlen(msg) + 1;
+	while (__sync_lock_test_and_set(&fork_farm->buglock, 1))
+		;
+	bool seen = false;
+	for (size_t pos = 0;pos < fork_farm->bugbytes && !seen;pos += strlen(&fork_farm->bugs[pos]) + 1)
+		seen = strcmp(&fork_farm->bugs[pos], msg) == 0;
+	if (!seen && fork_farm->bugbytes + len <= FARM_BUG_BYTES) {
+		memcpy(&fork_farm->bugs[fork_farm->bugbytes], msg, len);
+		fork_farm->bugbytes += len;
+	} else if (!seen) {
+		fork_farm->droppedbugs++;
+	}
+	__sync_lock_release(&fork_farm->buglock);
 }
 
 volatile int modellock = 0;
 
+#if !defined(MAC)
+/*
+ * No-fork mode
+ *
+ * With -n, executions are not rolled back by forking. Instead the snapshot
+ * heap is thrown away and created anew, the model-checker rebuilds its
+ * per-execution state in it, and the program resumes at the snapshot point
+ * with the part of the main stack it had then. The program has to reset its
+ * own globals, for instance from a hook registered with
+ * c11tester_set_reset_hook(). The top of the main stack comes from glibc, so
+ * the mode is not built on other platforms.
+ */
+
+extern "C" void *__libc_stack_end;
+
+static uintptr_t nofork_stack_start;
+static size_t nofork_stack_size;
+static void *nofork_stack_copy = NULL;
+static ucontext_t nofork_ctxt;
+
+/**
+ * @brief Find where the frames of the snapshot point start
+ *
+ * Called from the function that saves the snapshot point's context, so the
+ * address of a local here lies below every frame that the context returns
+ * into.
+ */
+static __attribute__((noinline)) void nofork_mark_stack()
+{
+	volatile char here = 0;
+	nofork_stack_start = (uintptr_t)&here;
+}
+
+/** @brief Save the frames of the main stack that the snapshot point returns into */
+static void nofork_save_stack()
+{
+	nofork_stack_size = (uintptr_t)__libc_stack_end - nofork_stack_start;
+	nofork_stack_copy = model_malloc(nofork_stack_size);
+	memcpy(nofork_stack_copy, (void *)nofork_stack_start, nofork_stack_size);
+}
+
+/** @brief Runs on the shared stack to start the next execution */
+static void nofork_restore()
+{
+	model->release_execution();
+	destroy_mspace(model_snapshot_space);
+	model_snapshot_space = create_snapshot_mspace();
+	reset_snapshot_heap_usage();
+	model->reset_execution();
+	memcpy((void *)nofork_stack_start, nofork_stack_copy, nofork_stack_size);
+	setcontext(&shared_ctxt);
+}
+
+static void nofork_roll_back()
+{
+	DEBUG("Rollback\n");
+	create_context(&nofork_ctxt, fork_snap->mStackBase, fork_snap->mStackSize, nofork_restore);
+	setcontext(&nofork_ctxt);
+}
+#endif	/* !MAC */
+
 static void fork_loop() {
 	/* switch back here when takesnapshot is called */
 	snapshotid = fork_snap->currSnapShotID;
+#if !defined(MAC)
 	if (model->params.nofork) {
+		nofork_save_stack();
 		setcontext(&shared_ctxt);
 		_Exit(EXIT_SUCCESS);
 	}
+#endif
+
+	if (model->params.jobs > 1 && fork_farm == NULL)
+		fork_farm_workers(model->params.jobs);
 
 	while (true) {
 		pid_t forkedID;
 		fork_snap->currSnapShotID = snapshotid + 1;
 
 		modellock = 1;
+		clock_gettime(CLOCK_MONOTONIC, &fork_started);
 		forkedID = fork();
 		modellock = 0;
 
 		if (0 == forkedID) {
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			fork_latency = (now.tv_sec - fork_started.tv_sec) * 1000000000ULL + now.tv_nsec - fork_started.tv_nsec;
 			setcontext(&shared_ctxt);
 		} else {
 			DEBUG("parent PID: %d, child PID: %d, snapshot ID: %d\n",
@@ -169,11 +485,20 @@ static void fork_loop() {
 }
 
 static void fork_startExecution() {
+	/* Later snapshots are taken in a child, where the loop that ran on this
+	 * stack is gone, so the stack can be reused */
+	static void *stack = NULL;
+	if (!stack)
+		stack = snapshot_calloc(STACK_SIZE_DEFAULT, 1);
 	/* switch to a new entryPoint context, on a new stack */
-	create_context(&private_ctxt, snapshot_calloc(STACK_SIZE_DEFAULT, 1), STACK_SIZE_DEFAULT, fork_loop);
+	create_context(&private_ctxt, stack, STACK_SIZE_DEFAULT, fork_loop);
 }
 
 static snapshot_id fork_take_snapshot() {
+#if !defined(MAC)
+	if (model->params.nofork)
+		nofork_mark_stack();
+#endif
 	model_swapcontext(&shared_ctxt, &private_ctxt);
 	DEBUG("TAKESNAPSHOT RETURN\n");
 	fork_snap->mIDToRollback = -1;
@@ -187,16 +512,582 @@ static void fork_roll_back(snapshot_id theID)
 	fork_exit();
 }
 
+#if !defined(MAC)
+/*
+ * In-process snapshotting
+ *
+ * Instead of forking a child per execution, the dirty backend keeps running
+ * in one process. At the snapshot point it records every mapping, copies the
+ * contents of the private writable ones and clears the kernel's soft-dirty
+ * bits (see Documentation/admin-guide/mm/soft-dirty.rst). Rolling back
+ * copies back only the pages whose soft-dirty bit got set, unmaps whatever
+ * was mapped since the snapshot, and undoes the few pieces of kernel state an
+ * execution changes (brk, file descriptors, helper threads, TLS base).
+ *
+ * All of the backend's own state lives in MAP_SHARED mappings, which it never
+ * tracks, so that restoring memory cannot clobber it. It relies on Linux's
+ * /proc interfaces, so it is not built on other platforms.
+ */
+
+#define DIRTY_MAX_REGIONS 8192
+#define DIRTY_MAX_FDS 256
+#define DIRTY_MAX_TIDS 256
+#define DIRTY_MAPS_SIZE ((size_t)1 << 20)
+/** Saved copies of file descriptors are placed at or above this number */
+#define DIRTY_FD_BASE 512
+/** Pages that did not exist at the snapshot point are zeroed on rollback */
+#define DIRTY_NOT_PRESENT ((size_t)-1)
+/** Signal used to make leftover helper threads exit */
+#define DIRTY_KILL_SIGNAL SIGRTMAX
+
+#define PAGEMAP_PRESENT (1ULL << 63)
+#define PAGEMAP_SWAPPED (1ULL << 62)
+#define PAGEMAP_SOFT_DIRTY (1ULL << 55)
+#define PAGEMAP_BATCH 512
+
+struct dirty_region {
+	uintptr_t start;
+	uintptr_t end;
+	int prot;
+	/** @brief Whether the mapping is backed by a file */
+	bool filebacked;
+	/** @brief Index of the region's first page in dirty_snapshotter::pages,
+	 *  or DIRTY_NOT_PRESENT if its contents are not saved */
+	size_t firstpage;
+};
+
+struct dirty_snapshotter {
+	/** @brief Every private mapping at the snapshot point, sorted by address */
+	struct dirty_region regions[DIRTY_MAX_REGIONS];
+	int numregions;
+
+	/** @brief Scratch list of the current mappings */
+	struct dirty_region current[DIRTY_MAX_REGIONS];
+	int numcurrent;
+
+	/** @brief For each saved page, the index of its copy in the store */
+	size_t *pages;
+	size_t numpages;
+	char *store;
+	size_t storepages;
+
+	/** @brief Program break at the snapshot point */
+	uintptr_t brk;
+	/** @brief TLS base of the thread that took the snapshot */
+	uintptr_t fsbase;
+
+	/** @brief Open descriptors at the snapshot point and their saved copies */
+	int fds[DIRTY_MAX_FDS];
+	int savedfds[DIRTY_MAX_FDS];
+	int numfds;
+
+	/** @brief Threads that existed at the snapshot point */
+	pid_t tids[DIRTY_MAX_TIDS];
+	int numtids;
+
+	/** @brief Whether the kernel tracks soft-dirty bits for us */
+	bool softdirty;
+
+	/** @brief The snapshot point whose state is saved; earlier ones are
+	 *  gone */
+	snapshot_id id;
+
+	ucontext_t restore_ctxt;
+	char maps[DIRTY_MAPS_SIZE];
+};
+
+static struct dirty_snapshotter *dirty_snap = NULL;
+
+static void * dirty_mmap(size_t size)
+{
+	void *mem = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON | MAP_NORESERVE, -1, 0);
+	if (mem == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	return mem;
+}
+
+static void dirty_thread_exit(int sig)
+{
+	/* Leave without running any pthread cleanup; rollback undoes the
+	 * library's bookkeeping for this thread anyway */
+	syscall(SYS_exit, 0);
+}
+
+static void dirty_clear_refs()
+{
+	int fd = open("/proc/self/clear_refs", O_WRONLY);
+	if (fd < 0 || write(fd, "4", 1) != 1)
+		dirty_snap->softdirty = false;
+	if (fd >= 0)
+		close(fd);
+}
+
+/**
+ * @brief List the numeric entries of a /proc directory
+ * @return The number of ids stored in @a ids
+ */
+static int dirty_list_ids(const char *path, int *ids, int maxids)
+{
+	char buf[4096];
+	int num = 0;
+	int dirfd = open(path, O_RDONLY | O_DIRECTORY);
+	if (dirfd < 0) {
+		perror("open");
+		exit(EXIT_FAILURE);
+	}
+	ssize_t len;
+	while ((len = getdents64(dirfd, buf, sizeof(buf))) > 0) {
+		for (ssize_t pos = 0;pos < len;) {
+			struct dirent64 *entry = (struct dirent64 *)&buf[pos];
+			pos += entry->d_reclen;
+			if (entry->d_name[0] < '0' || entry->d_name[0] > '9')
+				continue;
+			int id = atoi(entry->d_name);
+			if (id != dirfd && num < maxids)
+				ids[num++] = id;
+		}
+	}
+	close(dirfd);
+	return num;
+}
+
+/** @brief Parse /proc/self/maps into @a list, skipping shared mappings */
+static int dirty_read_maps(struct dirty_region *list)
+{
+	int fd = open("/proc/self/maps", O_RDONLY);
+	if (fd < 0) {
+		perror("open");
+		exit(EXIT_FAILURE);
+	}
+	size_t len = 0;
+	ssize_t ret;
+	while ((ret = read(fd, &dirty_snap->maps[len], DIRTY_MAPS_SIZE - 1 - len)) > 0)
+		len += ret;
+	close(fd);
+	dirty_snap->maps[len] = 0;
+
+	int num = 0;
+	char *line = dirty_snap->maps;
+	while (*line) {
+		char *next = strchr(line, '\n');
+		if (next)
+			*next++ = 0;
+		else
+			next = line + strlen(line);
+
+		char *pos;
+		uintptr_t start = strtoull(line, &pos, 16);
+		uintptr_t end = strtoull(pos + 1, &pos, 16);
+		const char *perms = pos + 1;
+		strtoull(perms + 5, &pos, 16);	/* offset */
+		strtoull(pos + 1, &pos, 16);	/* device major */
+		strtoull(pos + 1, &pos, 16);	/* device minor */
+		unsigned long inode = strtoul(pos + 1, &pos, 10);
+
+		if (perms[3] == 'p' && !strstr(pos, "[vsyscall]")) {
+			if (num == DIRTY_MAX_REGIONS) {
+				model_print("Too many mappings to snapshot in-process\n");
+				exit(EXIT_FAILURE);
+			}
+			struct dirty_region *r = &list[num++];
+			r->start = start;
+			r->end = end;
+			r->prot = (perms[0] == 'r' ? PROT_READ : 0) |
+								(perms[1] == 'w' ? PROT_WRITE : 0) |
+								(perms[2] == 'x' ? PROT_EXEC : 0);
+			r->filebacked = inode != 0;
+			r->firstpage = DIRTY_NOT_PRESENT;
+		}
+		line = next;
+	}
+	return num;
+}
+
+/**
+ * @brief Read the pagemap entries for a batch of pages
+ * @param fd An open /proc/self/pagemap
+ * @param addr The first page
+ * @param end The end of the range being walked
+ * @param entries Filled with up to PAGEMAP_BATCH entries
+ * @return The number of entries read
+ */
+static size_t dirty_read_pagemap(int fd, uintptr_t addr, uintptr_t end, uint64_t *entries)
+{
+	size_t count = (end - addr) / PAGESIZE;
+	if (count > PAGEMAP_BATCH)
+		count = PAGEMAP_BATCH;
+	ssize_t ret = pread(fd, entries, count * sizeof(uint64_t), (addr / PAGESIZE) * sizeof(uint64_t));
+	if (ret <= 0) {
+		perror("pread");
+		exit(EXIT_FAILURE);
+	}
+	return ret / sizeof(uint64_t);
+}
+
+/** @brief Should the page's contents be saved at the snapshot point? */
+static bool dirty_page_saved(const struct dirty_region *r, uint64_t entry)
+{
+	return r->filebacked || (entry & (PAGEMAP_PRESENT | PAGEMAP_SWAPPED));
+}
+
+/**
+ * @brief Make room in the store for pages faulted in after the first pass
+ *
+ * A page the second pass finds cannot be left out, or rolling back would
+ * take it for one that did not exist and zero it.
+ */
+static void dirty_grow_store()
+{
+	struct dirty_snapshotter *ds = dirty_snap;
+	size_t storepages = ds->storepages * 2;
+	/* A shared anonymous mapping cannot be extended in place */
+	char *store = (char *)dirty_mmap(storepages * PAGESIZE);
+	memcpy(store, ds->store, ds->storepages * PAGESIZE);
+	munmap(ds->store, ds->storepages * PAGESIZE);
+	ds->store = store;
+	ds->storepages = storepages;
+}
+
+/** @brief Drop the saved state of an earlier snapshot point */
+static void dirty_release()
+{
+	struct dirty_snapshotter *ds = dirty_snap;
+	for (int i = 0;i < ds->numfds;i++)
+		if (ds->savedfds[i] >= 0)
+			close(ds->savedfds[i]);
+	munmap(ds->pages, ds->numpages * sizeof(size_t));
+	munmap(ds->store, ds->storepages * PAGESIZE);
+	ds->pages = NULL;
+	ds->numfds = 0;
+}
+
+static void dirty_capture()
+{
+	struct dirty_snapshotter *ds = dirty_snap;
+	if (ds->pages)
+		dirty_release();
+	ds->brk = syscall(SYS_brk, 0);
+#ifdef TLS
+	syscall(SYS_arch_prctl, ARCH_GET_FS, &ds->fsbase);
+#endif
+	ds->numtids = dirty_list_ids("/proc/self/task", ds->tids, DIRTY_MAX_TIDS);
+	ds->numfds = dirty_list_ids("/proc/self/fd", ds->fds, DIRTY_MAX_FDS);
+	for (int i = 0;i < ds->numfds;i++)
+		ds->savedfds[i] = fcntl(ds->fds[i], F_DUPFD_CLOEXEC, DIRTY_FD_BASE);
+
+	uint64_t entries[PAGEMAP_BATCH];
+	int pagemap = open("/proc/self/pagemap", O_RDONLY);
+	if (pagemap < 0) {
+		perror("open");
+		exit(EXIT_FAILURE);
+	}
+
+	/* First pass: size the page table and the store */
+	ds->numregions = dirty_read_maps(ds->regions);
+	size_t numpages = 0, storepages = 0;
+	for (int i = 0;i < ds->numregions;i++) {
+		struct dirty_region *r = &ds->regions[i];
+		if (!(r->prot & PROT_WRITE))
+			continue;
+		r->firstpage = numpages;
+		numpages += (r->end - r->start) / PAGESIZE;
+		for (uintptr_t addr = r->start;addr < r->end;) {
+			size_t count = dirty_read_pagemap(pagemap, addr, r->end, entries);
+			for (size_t j = 0;j < count;j++, addr += PAGESIZE)
+				if (dirty_page_saved(r, entries[j]))
+					storepages++;
+		}
+	}
+
+	/* Leave slack for pages faulted in while we copy; the store grows if
+	   that is not enough */
+	storepages += PAGEMAP_BATCH;
+	ds->pages = (size_t *)dirty_mmap(numpages * sizeof(size_t));
+	ds->numpages = numpages;
+	ds->store = (char *)dirty_mmap(storepages * PAGESIZE);
+	ds->storepages = storepages;
+
+	/* Second pass: copy the pages */
+	size_t next = 0;
+	for (int i = 0;i < ds->numregions;i++) {
+		struct dirty_region *r = &ds->regions[i];
+		if (r->firstpage == DIRTY_NOT_PRESENT)
+			continue;
+		size_t *pages = &ds->pages[r->firstpage];
+		for (uintptr_t addr = r->start;addr < r->end;) {
+			size_t count = dirty_read_pagemap(pagemap, addr, r->end, entries);
+			for (size_t j = 0;j < count;j++, addr += PAGESIZE) {
+				size_t index = (addr - r->start) / PAGESIZE;
+				if (dirty_page_saved(r, entries[j])) {
+					if (next == ds->storepages)
+						dirty_grow_store();
+					memcpy(&ds->store[next * PAGESIZE], (void *)addr, PAGESIZE);
+					pages[index] = next++;
+				} else {
+					pages[index] = DIRTY_NOT_PRESENT;
+				}
+			}
+		}
+	}
+	close(pagemap);
+	dirty_clear_refs();
+}
+
+/** @brief Unmap the parts of [start, end) that were not mapped at the snapshot point */
+static void dirty_unmap_new(uintptr_t start, uintptr_t end)
+{
+	const struct dirty_snapshotter *ds = dirty_snap;
+	uintptr_t pos = start;
+	for (int i = 0;i < ds->numregions && pos < end;i++) {
+		const struct dirty_region *r = &ds->regions[i];
+		if (r->end <= pos)
+			continue;
+		if (r->start >= end)
+			break;
+		if (r->start > pos)
+			munmap((void *)pos, r->start - pos);
+		pos = r->end;
+	}
+	if (pos < end)
+		munmap((void *)pos, end - pos);
+}
+
+/** @return True if [start, end) is entirely covered by the current mappings */
+static bool dirty_is_mapped(uintptr_t start, uintptr_t end, bool *writable)
+{
+	const struct dirty_snapshotter *ds = dirty_snap;
+	uintptr_t pos = start;
+	*writable = true;
+	for (int i = 0;i < ds->numcurrent && pos < end;i++) {
+		const struct dirty_region *r = &ds->current[i];
+		if (r->end <= pos)
+			continue;
+		if (r->start > pos)
+			return false;
+		if (!(r->prot & PROT_WRITE))
+			*writable = false;
+		pos = r->end;
+	}
+	return pos >= end;
+}
+
+static void dirty_restore_region(int pagemap, const struct dirty_region *r)
+{
+	struct dirty_snapshotter *ds = dirty_snap;
+	size_t length = r->end - r->start;
+	bool writable;
+	bool everything = !ds->softdirty;
+
+	if (!dirty_is_mapped(r->start, r->end, &writable)) {
+		/* The execution unmapped part of it, so start over from scratch */
+		if (mmap((void *)r->start, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON | MAP_FIXED, -1, 0) == MAP_FAILED) {
+			perror("mmap");
+			exit(EXIT_FAILURE);
+		}
+		everything = true;
+		writable = false;
+	} else if (!writable) {
+		mprotect((void *)r->start, length, PROT_READ | PROT_WRITE);
+	}
+
+	const size_t *pages = &ds->pages[r->firstpage];
+	uint64_t entries[PAGEMAP_BATCH];
+	/* Pages that did not exist at the snapshot point are dropped in runs */
+	uintptr_t zapstart = 0, zapend = 0;
+	for (uintptr_t addr = r->start;addr < r->end;) {
+		size_t count = dirty_read_pagemap(pagemap, addr, r->end, entries);
+		for (size_t j = 0;j < count;j++, addr += PAGESIZE) {
+			if (!everything && !(entries[j] & PAGEMAP_SOFT_DIRTY))
+				continue;
+			size_t copy = pages[(addr - r->start) / PAGESIZE];
+			if (copy != DIRTY_NOT_PRESENT) {
+				memcpy((void *)addr, &ds->store[copy * PAGESIZE], PAGESIZE);
+			} else if (entries[j] & (PAGEMAP_PRESENT | PAGEMAP_SWAPPED)) {
+				if (addr != zapend) {
+					if (zapend != zapstart)
+						madvise((void *)zapstart, zapend - zapstart, MADV_DONTNEED);
+					zapstart = addr;
+				}
+				zapend = addr + PAGESIZE;
+			}
+		}
+	}
+	if (zapend != zapstart)
+		madvise((void *)zapstart, zapend - zapstart, MADV_DONTNEED);
+
+	if (!writable)
+		mprotect((void *)r->start, length, r->prot);
+}
+
+/** @brief Make every thread created since the snapshot point exit */
+static void dirty_kill_threads()
+{
+	struct dirty_snapshotter *ds = dirty_snap;
+	pid_t tids[DIRTY_MAX_TIDS];
+	int numtids = dirty_list_ids("/proc/self/task", tids, DIRTY_MAX_TIDS);
+	pid_t pid = getpid();
+	for (int i = 0;i < numtids;i++) {
+		bool old = false;
+		for (int j = 0;j < ds->numtids;j++)
+			old |= tids[i] == ds->tids[j];
+		if (old)
+			continue;
+		syscall(SYS_tgkill, pid, tids[i], DIRTY_KILL_SIGNAL);
+		while (syscall(SYS_tgkill, pid, tids[i], 0) == 0)
+			sched_yield();
+	}
+}
+
+/** @brief Point the snapshot's descriptors back at their files and close the rest */
+static void dirty_restore_fds()
+{
+	struct dirty_snapshotter *ds = dirty_snap;
+	for (int i = 0;i < ds->numfds;i++)
+		if (ds->savedfds[i] >= 0)
+			dup2(ds->savedfds[i], ds->fds[i]);
+
+	int fds[DIRTY_MAX_FDS];
+	int numfds = dirty_list_ids("/proc/self/fd", fds, DIRTY_MAX_FDS);
+	for (int i = 0;i < numfds;i++) {
+		bool old = false;
+		for (int j = 0;j < ds->numfds;j++)
+			old |= fds[i] == ds->fds[j] || fds[i] == ds->savedfds[j];
+		if (!old)
+			close(fds[i]);
+	}
+}
+
+/** @brief Runs on the shared stack to put the process back at the snapshot point */
+static void dirty_restore()
+{
+	struct dirty_snapshotter *ds = dirty_snap;
+#ifdef TLS
+	syscall(SYS_arch_prctl, ARCH_SET_FS, ds->fsbase);
+#endif
+	dirty_kill_threads();
+	dirty_restore_fds();
+	syscall(SYS_brk, ds->brk);
+
+	ds->numcurrent = dirty_read_maps(ds->current);
+	for (int i = 0;i < ds->numcurrent;i++)
+		dirty_unmap_new(ds->current[i].start, ds->current[i].end);
+
+	int pagemap = open("/proc/self/pagemap", O_RDONLY);
+	if (pagemap < 0) {
+		perror("open");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0;i < ds->numregions;i++)
+		if (ds->regions[i].firstpage != DIRTY_NOT_PRESENT)
+			dirty_restore_region(pagemap, &ds->regions[i]);
+	close(pagemap);
+
+	dirty_clear_refs();
+	setcontext(&shared_ctxt);
+}
+
+/** @brief Checks that the kernel sets soft-dirty bits after clear_refs */
+static bool dirty_probe_softdirty()
+{
+	dirty_snap->softdirty = true;
+	dirty_clear_refs();
+	if (!dirty_snap->softdirty)
+		return false;
+	volatile char *page = (volatile char *)dirty_snap->maps;
+	*page = 0;
+
+	int pagemap = open("/proc/self/pagemap", O_RDONLY);
+	uint64_t entry = 0;
+	if (pagemap < 0)
+		return false;
+	bool ok = pread(pagemap, &entry, sizeof(entry), ((uintptr_t)page / PAGESIZE) * sizeof(entry)) == sizeof(entry);
+	close(pagemap);
+	return ok && (entry & PAGEMAP_SOFT_DIRTY);
+}
+
+static void dirty_loop()
+{
+	if (model->params.jobs > 1 && fork_farm == NULL)
+		fork_farm_workers(model->params.jobs);
+
+	/* A later snapshot point replaces the earlier one */
+	if (dirty_snap == NULL) {
+		dirty_snap = (struct dirty_snapshotter *)dirty_mmap(sizeof(struct dirty_snapshotter));
+		dirty_snap->softdirty = dirty_probe_softdirty();
+		if (!dirty_snap->softdirty)
+			model_print("Soft-dirty bits unavailable; rollback will restore every page\n");
+
+		struct sigaction sa;
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = dirty_thread_exit;
+		sigaction(DIRTY_KILL_SIGNAL, &sa, NULL);
+	}
+
+	snapshotid = fork_snap->currSnapShotID++;
+	dirty_snap->id = snapshotid;
+	dirty_capture();
+	setcontext(&shared_ctxt);
+}
+
+static void dirty_startExecution() {
+	/* The snapshot loop runs on the shared stack, which rollback leaves alone */
+	create_context(&private_ctxt, fork_snap->mStackBase, fork_snap->mStackSize, dirty_loop);
+}
+
+static snapshot_id dirty_take_snapshot() {
+	model_swapcontext(&shared_ctxt, &private_ctxt);
+	DEBUG("TAKESNAPSHOT RETURN\n");
+	return snapshotid;
+}
+
+static void dirty_roll_back(snapshot_id theID)
+{
+	DEBUG("Rollback\n");
+	/* Only the latest snapshot point is kept */
+	if (theID != dirty_snap->id) {
+		model_print("Cannot roll back in-process to snapshot %u; only %u is saved\n", theID, dirty_snap->id);
+		exit(EXIT_FAILURE);
+	}
+	create_context(&dirty_snap->restore_ctxt, fork_snap->mStackBase, fork_snap->mStackSize, dirty_restore);
+	setcontext(&dirty_snap->restore_ctxt);
+}
+#endif	/* !MAC */
+
+/**
+ * @brief Report what it cost to fork the process running this execution
+ * @param latency Returns the nanoseconds the fork took to return in the child
+ * @param faults Returns the page faults (mostly copy-on-write) taken since
+ * @return False if executions are not forked
+ */
+bool snapshot_fork_cost(uint64_t *latency, long *faults)
+{
+	if (model->params.softdirty || model->params.nofork)
+		return false;
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	*latency = fork_latency;
+	*faults = usage.ru_minflt;
+	return true;
+}
+
 /**
  * @brief Initializes the snapshot system
- * @param entryPoint the function that should run the program.
+ * @param params The heap options, parsed before the model-checker exists
  */
-void snapshot_system_init(unsigned int numheappages)
+void snapshot_system_init(const struct model_params *params)
 {
-	fork_snapshot_init(numheappages);
+	fork_snapshot_init(params);
 }
 
 void startExecution() {
+#if !defined(MAC)
+	if (model->params.softdirty) {
+		dirty_startExecution();
+		return;
+	}
+#endif
 	fork_startExecution();
 }
 
@@ -205,6 +1096,10 @@ void startExecution() {
  */
 snapshot_id take_snapshot()
 {
+#if !defined(MAC)
+	if (model->params.softdirty)
+		return dirty_take_snapshot();
+#endif
 	return fork_take_snapshot();
 }
 
@@ -213,5 +1108,15 @@ snapshot_id take_snapshot()
  */
 void snapshot_roll_back(snapshot_id theID)
 {
+#if !defined(MAC)
+	if (model->params.softdirty) {
+		dirty_roll_back(theID);
+		return;
+	}
+	if (model->params.nofork) {
+		nofork_roll_back();
+		return;
+	}
+#endif
 	fork_roll_back(theID);
 }
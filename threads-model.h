@@ -109,6 +109,14 @@ public:
 	bool is_model_thread() const { return model_thread; }
 
 	void * get_stack_addr() { return stack; }
+	/** @return True if addr is on the stack this thread's user code runs on */
+	bool on_stack(const void *addr) const {
+#ifdef TLS
+		return (uintptr_t)addr - (uintptr_t)helper_pstack < helper_pstack_size;
+#else
+		return (uintptr_t)addr - (uintptr_t)stack < STACK_SIZE;
+#endif
+	}
 	ClockVector * get_acq_fence_cv() { return acq_fence_cv; }
 
 	friend void thread_startup();
@@ -174,6 +182,12 @@ private:
 	void * helper_stack;
 public:
 	char *tls;
+	/** @brief Process that created the helper thread; a process forked
+	 *  later from a branch snapshot does not have it */
+	pid_t helper_pid;
+	/** @brief Stack of the helper thread, which the user thread runs on */
+	void *helper_pstack;
+	size_t helper_pstack_size;
 	ucontext_t helpercontext;
 	pthread_mutex_t mutex;
 	pthread_mutex_t mutex2;
@@ -200,6 +214,7 @@ private:
 
 #ifdef TLS
 uintptr_t get_tls_addr();
+void set_tls_addr(uintptr_t addr);
 void tlsdestructor(void *v);
 #endif
 
@@ -240,6 +255,7 @@ int real_pthread_mutex_unlock (pthread_mutex_t *__mutex);
 int real_pthread_create (pthread_t *__restrict __newthread, const pthread_attr_t *__restrict __attr, void *(*__start_routine)(void *), void *__restrict __arg);
 int real_pthread_join (pthread_t __th, void ** __thread_return);
 void real_pthread_exit (void * value_ptr) __attribute__((noreturn));
+int real_pthread_key_delete (pthread_key_t __key);
 void real_init_all();
 
 #endif	/* __THREADS_MODEL_H__ */
@@ -3,6 +3,8 @@
  */
 
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include <threads.h>
 #include "mutex.h"
@@ -30,7 +32,7 @@ uintptr_t get_tls_addr() {
 extern "C" {
 int arch_prctl(int code, unsigned long addr);
 }
-static void set_tls_addr(uintptr_t addr) {
+void set_tls_addr(uintptr_t addr) {
 	arch_prctl(ARCH_SET_FS, addr);
 	asm ("mov %0, %%fs:0" : : "r" (addr) : "memory");
 }
@@ -74,12 +76,20 @@ thread_id_t thread_current_id(void)
 	return model->get_current_thread_id();
 }
 
+/** Whether modelexit() is registered and has not run yet; no-fork mode runs
+ *  every execution in the same process */
+static bool modelexit_registered = false;
+
 void modelexit() {
+	modelexit_registered = false;
 	model->switch_thread(new ModelAction(THREAD_FINISH, std::memory_order_seq_cst, thread_current()));
 }
 
 void initMainThread() {
-	atexit(modelexit);
+	if (!modelexit_registered) {
+		atexit(modelexit);
+		modelexit_registered = true;
+	}
 	Thread * curr_thread = thread_current();
 	model->switch_thread(new ModelAction(THREAD_START, std::memory_order_seq_cst, curr_thread));
 }
@@ -154,6 +164,12 @@ void real_pthread_exit (void * value_ptr) {
 	pthread_exit_p(value_ptr);
 }
 
+static int (*pthread_key_delete_p) (pthread_key_t __key) = NULL;
+
+int real_pthread_key_delete (pthread_key_t __key) {
+	return pthread_key_delete_p(__key);
+}
+
 void real_init_all() {
 	char * error;
 	if (!real_epoll_wait_p) {
@@ -206,6 +222,13 @@ void real_init_all() {
 			exit(EXIT_FAILURE);
 		}
 	}
+	if (!pthread_key_delete_p) {
+		pthread_key_delete_p = (int (*)(pthread_key_t __key))dlsym(RTLD_NEXT, "pthread_key_delete");
+		if ((error = dlerror()) != NULL) {
+			fputs(error, stderr);
+			exit(EXIT_FAILURE);
+		}
+	}
 }
 
 #ifdef TLS
@@ -217,6 +240,9 @@ void finalize_helper_thread() {
 	//Wait in the kernel until it is time for us to finish
 	real_pthread_mutex_lock(&curr_thread->mutex2);
 	real_pthread_mutex_unlock(&curr_thread->mutex2);
+	//An execution reset in-process may end before the thread does
+	if (!curr_thread->is_complete())
+		real_pthread_exit(NULL);
 	//return to helper thread function
 	setcontext(&curr_thread->context);
 }
@@ -280,8 +306,22 @@ void setup_context() {
 	real_pthread_mutex_init(&curr_thread->mutex2, NULL);
 	real_pthread_mutex_lock(&curr_thread->mutex2);
 
-	/* Create the real thread */
-	real_pthread_create(&curr_thread->thread, NULL, helper_thread, NULL);
+	/* Create the real thread on a stack of our own. In a forked child glibc
+	 * recycles the stacks (and clears the thread-specific data) of threads
+	 * it allocated itself, which would break the user threads a branch
+	 * snapshot carries over. */
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_getstacksize(&attr, &curr_thread->helper_pstack_size);
+	curr_thread->helper_pstack = mmap(NULL, curr_thread->helper_pstack_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK | MAP_NORESERVE, -1, 0);
+	if (curr_thread->helper_pstack == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	pthread_attr_setstack(&attr, curr_thread->helper_pstack, curr_thread->helper_pstack_size);
+	real_pthread_create(&curr_thread->thread, &attr, helper_thread, NULL);
+	pthread_attr_destroy(&attr);
+	curr_thread->helper_pid = getpid();
 	bool notdone = true;
 	while(notdone) {
 		real_pthread_mutex_lock(&curr_thread->mutex);
@@ -385,9 +425,12 @@ void Thread::freeResources() {
 		stack_free(stack);
 #ifdef TLS
 	if (this != model->getInitThread()) {
-		real_pthread_mutex_unlock(&mutex2);
-		real_pthread_join(thread, NULL);
+		if (helper_pid == getpid()) {
+			real_pthread_mutex_unlock(&mutex2);
+			real_pthread_join(thread, NULL);
+		}
 		stack_free(helper_stack);
+		munmap(helper_pstack, helper_pstack_size);
 	}
 #endif
 	state = THREAD_FREED;
@@ -412,6 +455,9 @@ Thread::Thread(thread_id_t tid) :
 	stack(NULL),
 #ifdef TLS
 	tls(NULL),
+	helper_pid(0),
+	helper_pstack(NULL),
+	helper_pstack_size(0),
 #endif
 	user_thread(NULL),
 	id(tid),
@@ -439,6 +485,9 @@ Thread::Thread(thread_id_t tid, thrd_t *t, void (*func)(void *), void *a, Thread
 	arg(a),
 #ifdef TLS
 	tls(NULL),
+	helper_pid(0),
+	helper_pstack(NULL),
+	helper_pstack_size(0),
 #endif
 	user_thread(t),
 	id(tid),
@@ -473,6 +522,9 @@ Thread::Thread(thread_id_t tid, thrd_t *t, void *(*func)(void *), void *a, Threa
 	arg(a),
 #ifdef TLS
 	tls(NULL),
+	helper_pid(0),
+	helper_pstack(NULL),
+	helper_pstack_size(0),
 #endif
 	user_thread(t),
 	id(tid),